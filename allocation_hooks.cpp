@@ -0,0 +1,55 @@
+// Replacements of the global operators, counting calls per thread for
+// thread_allocations(). Linked into the executables only, so that programs
+// using the ozz_assimp_loader library keep their own allocator.
+
+#include "memory_stats.hpp"
+
+#include <cstdlib>
+#include <new>
+
+void *operator new(std::size_t size) {
+  record_allocation(size);
+  if (size == 0) {
+    size = 1;
+  }
+  for (;;) {
+    if (void *p = std::malloc(size)) {
+      return p;
+    }
+    std::new_handler handler = std::get_new_handler();
+    if (!handler) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+void *operator new[](std::size_t size) { return operator new(size); }
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return operator new(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  return operator new(size, std::nothrow);
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete[](void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+  std::free(p);
+}
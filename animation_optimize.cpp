@@ -0,0 +1,85 @@
+#include "animation_optimize.hpp"
+#include "log.hpp"
+
+#include <ozz/animation/offline/animation_optimizer.h>
+
+#include <fstream>
+#include <sstream>
+
+void count_keys(const ozz::animation::offline::RawAnimation &animation,
+                size_t &keys, size_t &bytes) {
+  typedef ozz::animation::offline::RawAnimation RawAnimation;
+  keys = 0;
+  bytes = 0;
+  for (const RawAnimation::JointTrack &track : animation.tracks) {
+    keys += track.translations.size() + track.rotations.size() +
+            track.scales.size();
+    bytes += track.translations.size() * sizeof(RawAnimation::TranslationKey) +
+             track.rotations.size() * sizeof(RawAnimation::RotationKey) +
+             track.scales.size() * sizeof(RawAnimation::ScaleKey);
+  }
+}
+
+bool optimize_animation(const ozz::animation::offline::RawAnimation &input,
+                        const ozz::animation::Skeleton &skeleton,
+                        const loader::options &opts,
+                        ozz::animation::offline::RawAnimation &output) {
+  typedef ozz::animation::offline::AnimationOptimizer AnimationOptimizer;
+  AnimationOptimizer optimizer;
+  optimizer.setting = AnimationOptimizer::Setting(
+      opts.anim_tolerance.tolerance, opts.anim_tolerance.distance);
+
+  if (!opts.joint_tolerances.empty()) {
+    ozz::span<const char *const> joint_names = skeleton.joint_names();
+    for (size_t i = 0; i < joint_names.size(); ++i) {
+      auto it = opts.joint_tolerances.find(joint_names[i]);
+      if (it != opts.joint_tolerances.end()) {
+        optimizer.joints_setting_override[static_cast<int>(i)] =
+            AnimationOptimizer::Setting(it->second.tolerance,
+                                        it->second.distance);
+      }
+    }
+  }
+  return optimizer(input, skeleton, &output);
+}
+
+bool read_animation_tolerances(const std::string &filename,
+                               loader::options &opts) {
+  std::ifstream file(filename);
+  if (!file) {
+    LOG(ERROR) << "Could not open animation tolerance file " << filename;
+    return false;
+  }
+  std::string line;
+  size_t line_number = 0;
+  while (std::getline(file, line)) {
+    line_number++;
+    std::istringstream in(line);
+    std::string kind;
+    if (!(in >> kind) || kind[0] == '#') {
+      continue;
+    }
+    loader::animation_tolerance tolerance;
+    std::string name;
+    if (kind == "default" &&
+        in >> tolerance.tolerance >> tolerance.distance) {
+      opts.anim_tolerance = tolerance;
+    } else if (kind == "joint" &&
+               in >> name >> tolerance.tolerance >> tolerance.distance) {
+      opts.joint_tolerances[name] = tolerance;
+    } else {
+      LOG(ERROR) << filename << ":" << line_number
+                 << ": expected 'default <tolerance> <distance>' or 'joint "
+                    "<name> <tolerance> <distance>'";
+      return false;
+    }
+  }
+  return true;
+}
+
+void print_animation_report(const animation_report &report) {
+  LOG(INFO) << "Animation " << report.name << ": " << report.keys_in
+            << " keys (" << report.raw_bytes_in << " bytes) -> "
+            << report.keys_out << " keys (" << report.raw_bytes_out
+            << " bytes), runtime size " << report.runtime_bytes << " bytes.";
+}
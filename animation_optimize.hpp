@@ -0,0 +1,42 @@
+// Optional keyframe reduction of imported animations, through ozz's
+// AnimationOptimizer.
+
+#pragma once
+
+#include "loader.hpp"
+
+#include <ozz/animation/offline/raw_animation.h>
+#include <ozz/animation/runtime/skeleton.h>
+
+// Key counts and sizes of one animation, before and after optimization.
+struct animation_report {
+  std::string name;
+  size_t keys_in = 0;
+  size_t keys_out = 0;
+  size_t raw_bytes_in = 0;
+  size_t raw_bytes_out = 0;
+  // Size of the built runtime animation.
+  size_t runtime_bytes = 0;
+};
+
+// Number of keys and bytes used by the keys of a raw animation.
+void count_keys(const ozz::animation::offline::RawAnimation &animation,
+                size_t &keys, size_t &bytes);
+
+// Reduces the keys of `input` within the tolerances of opts.anim_tolerance
+// and opts.joint_tolerances (joints are matched by name). Errors are
+// measured hierarchically: a joint's tolerance applies at `distance` from
+// it, after its children have been affected by its own approximation.
+bool optimize_animation(const ozz::animation::offline::RawAnimation &input,
+                        const ozz::animation::Skeleton &skeleton,
+                        const loader::options &opts,
+                        ozz::animation::offline::RawAnimation &output);
+
+// Reads tolerances from a file with one setting per line:
+//   default <tolerance> <distance>
+//   joint <name> <tolerance> <distance>
+// Empty lines and lines starting with '#' are ignored.
+bool read_animation_tolerances(const std::string &filename,
+                               loader::options &opts);
+
+void print_animation_report(const animation_report &report);
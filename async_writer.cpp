@@ -0,0 +1,66 @@
+#include "async_writer.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+
+async_writer::async_writer(output_sink &sink, size_t max_pending)
+    : sink(sink), max_pending(std::max<size_t>(max_pending, 1)) {
+  thread = std::thread(&async_writer::run, this);
+}
+
+async_writer::~async_writer() { finish(); }
+
+void async_writer::write(const std::string &name,
+                         std::unique_ptr<buffer_stream> buffer) {
+  std::unique_lock<std::mutex> lock(mutex);
+  changed.wait(lock, [this]() { return pending.size() < max_pending; });
+  pending.push_back(std::make_pair(name, std::move(buffer)));
+  changed.notify_all();
+}
+
+bool async_writer::finish() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  changed.notify_all();
+  if (thread.joinable()) {
+    thread.join();
+  }
+  return success;
+}
+
+void async_writer::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  for (;;) {
+    changed.wait(lock, [this]() { return stopping || !pending.empty(); });
+    if (pending.empty()) {
+      return;
+    }
+    std::pair<std::string, std::unique_ptr<buffer_stream>> item =
+        std::move(pending.front());
+    pending.pop_front();
+    changed.notify_all();
+    lock.unlock();
+
+    const stage_sample sample;
+    const std::vector<char> &data = item.second->data();
+    ozz::io::Stream *stream = sink.open(item.first);
+    const bool written =
+        stream && stream->Write(data.data(), data.size()) == data.size();
+    const bool closed = stream && sink.close(stream);
+    if (!written || !closed) {
+      LOG(ERROR) << "Could not write " << item.first;
+    }
+    item.second.reset();
+    stage_timing t;
+    sample.finish(t);
+
+    lock.lock();
+    success = success && written && closed;
+    timing.seconds += t.seconds;
+    timing.allocations += t.allocations;
+    timing.allocated_bytes += t.allocated_bytes;
+    timing.peak_rss_bytes = std::max(timing.peak_rss_bytes, t.peak_rss_bytes);
+  }
+}
@@ -0,0 +1,53 @@
+// Writes outputs serialized in memory to an output_sink on a background
+// thread, so that building and serializing on the calling threads overlaps
+// with disk I/O.
+
+#pragma once
+
+#include "output_sink.hpp"
+#include "stage_timings.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+class async_writer {
+public:
+  // At most `max_pending` outputs wait in memory; write() blocks beyond
+  // that, bounding memory when the sink is slower than the producers.
+  async_writer(output_sink &sink, size_t max_pending);
+
+  // Finishes if finish() was not called.
+  ~async_writer();
+
+  async_writer(const async_writer &) = delete;
+  async_writer &operator=(const async_writer &) = delete;
+
+  // Queues `buffer` as the output `name`. Safe to call from any thread.
+  void write(const std::string &name, std::unique_ptr<buffer_stream> buffer);
+
+  // Waits until everything queued is written and stops the thread. Returns
+  // false if any output could not be written. The sink is only used by the
+  // background thread until then.
+  bool finish();
+
+  // Time and allocations of the background thread spent writing.
+  const stage_timing &get_timing() const { return timing; }
+
+protected:
+  void run();
+
+  output_sink &sink;
+  const size_t max_pending;
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<std::pair<std::string, std::unique_ptr<buffer_stream>>> pending;
+  bool stopping = false;
+  bool success = true;
+  stage_timing timing;
+  std::thread thread;
+};
@@ -0,0 +1,261 @@
+#include "batch.hpp"
+#include "conversion_cache.hpp"
+#include "log.hpp"
+#include "mmap_io_system.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <thread>
+
+work_stealing_queues::work_stealing_queues(size_t workers) {
+  for (size_t i = 0; i < workers; ++i) {
+    queues.emplace_back(new queue());
+  }
+}
+
+void work_stealing_queues::push(size_t worker, size_t item) {
+  queue &q = *queues[worker];
+  std::lock_guard<std::mutex> lock(q.mutex);
+  q.items.push_back(item);
+}
+
+bool work_stealing_queues::pop(size_t worker, size_t &item) {
+  {
+    queue &own = *queues[worker];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.items.empty()) {
+      item = own.items.front();
+      own.items.pop_front();
+      return true;
+    }
+  }
+  for (size_t i = 1; i < queues.size(); ++i) {
+    queue &victim = *queues[(worker + i) % queues.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.items.empty()) {
+      item = victim.items.back();
+      victim.items.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+void convert_file(Assimp::Importer &importer, const std::string &file,
+                  const std::string &name, const loader::options &opts,
+                  batch_result &result) {
+  typedef std::chrono::steady_clock clock;
+  const clock::time_point start = clock::now();
+  result.file = file;
+
+  std::string key;
+  conversion_cache cache(opts.cache_dir);
+  const bool use_cache =
+      !opts.cache_dir.empty() &&
+      conversion_cache::make_key(file, loader::import_flags_for(opts), opts,
+                                 key);
+  if (use_cache && cache.restore(key, loader::output_path_for(name))) {
+    result.success = true;
+    result.cached = true;
+  } else {
+    try {
+      const stage_sample import_sample;
+      loader::configure_importer(importer, opts);
+      const aiScene *scene =
+          importer.ReadFile(file, loader::import_flags_for(opts));
+      // configure_importer installs an mmap_io_system.
+      const std::vector<std::string> dependencies =
+          static_cast<mmap_io_system *>(importer.GetIOHandler())
+              ->take_accessed_files();
+      stage_timing import;
+      import_sample.finish(import);
+      import.stage = "import";
+      if (!scene) {
+        result.error = importer.GetErrorString();
+      } else {
+        loader file_loader(opts);
+        result.success = file_loader.load(scene, name);
+        result.stats = file_loader.get_stats();
+        result.stats.stages.insert(result.stats.stages.begin(), import);
+        if (!result.success) {
+          result.error = "conversion failed";
+        } else if (use_cache &&
+                   !cache.store(key, file_loader.get_written_files(),
+                                dependencies)) {
+          LOG(WARNING) << "Could not store " << file << " in the cache.";
+        }
+      }
+    } catch (std::exception &e) {
+      result.error = e.what();
+    }
+    importer.FreeScene();
+  }
+  result.seconds =
+      std::chrono::duration<double>(clock::now() - start).count();
+  result.stats.file = file;
+  result.stats.success = result.success;
+  result.stats.cached = result.cached;
+  result.stats.seconds = result.seconds;
+}
+
+bool collect_batch_inputs(const std::string &source,
+                          std::vector<batch_input> &inputs) {
+  namespace fs = boost::filesystem;
+  boost::system::error_code ec;
+  fs::path source_path(source);
+
+  if (fs::is_directory(source_path, ec)) {
+    Assimp::Importer importer;
+    for (fs::recursive_directory_iterator it(source_path, ec), end;
+         !ec && it != end; it.increment(ec)) {
+      if (fs::is_regular_file(it->status()) &&
+          importer.IsExtensionSupported(it->path().extension().string())) {
+        batch_input input;
+        input.file = it->path().string();
+        input.name = it->path().lexically_relative(source_path).string();
+        inputs.push_back(input);
+      }
+    }
+    if (ec) {
+      LOG(ERROR) << "Could not read directory " << source << ": "
+                 << ec.message();
+      return false;
+    }
+  } else {
+    std::ifstream manifest(source);
+    if (!manifest) {
+      LOG(ERROR) << "Could not open batch manifest " << source;
+      return false;
+    }
+    const fs::path base =
+        fs::absolute(source_path.parent_path()).lexically_normal();
+    std::string line;
+    while (std::getline(manifest, line)) {
+      line = line.substr(0, line.find('#'));
+      line.erase(0, line.find_first_not_of(" \t\r"));
+      line.erase(line.find_last_not_of(" \t\r") + 1);
+      if (line.empty()) {
+        continue;
+      }
+      fs::path p(line);
+      batch_input input;
+      input.file = p.is_absolute() ? p.string() : (base / p).string();
+      const fs::path relative =
+          fs::path(input.file).lexically_normal().lexically_relative(base);
+      if (relative.empty() || *relative.begin() == "..") {
+        LOG(ERROR) << "Batch input " << line << " is outside "
+                   << base.string();
+        return false;
+      }
+      input.name = relative.string();
+      inputs.push_back(input);
+    }
+  }
+  std::sort(inputs.begin(), inputs.end(),
+            [](const batch_input &a, const batch_input &b) {
+              return a.file < b.file;
+            });
+  return true;
+}
+
+bool run_batch(const std::string &source, const loader::options &opts) {
+  typedef std::chrono::steady_clock clock;
+  const clock::time_point batch_start = clock::now();
+
+  std::vector<batch_input> inputs;
+  if (!collect_batch_inputs(source, inputs)) {
+    return false;
+  }
+
+  batch_summary summary;
+  summary.files = inputs.size();
+  summary.workers = std::min(resolve_jobs(opts.jobs),
+                             std::max<size_t>(inputs.size(), 1));
+  summary.results.resize(inputs.size());
+
+  // Largest first, dealt round robin, so that huge files start early instead
+  // of ending up as a tail that a single worker converts alone.
+  std::vector<std::pair<uintmax_t, size_t>> by_size;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    boost::system::error_code ec;
+    uintmax_t size = boost::filesystem::file_size(inputs[i].file, ec);
+    by_size.push_back(std::make_pair(ec ? 0 : size, i));
+  }
+  std::sort(by_size.begin(), by_size.end(),
+            [](const std::pair<uintmax_t, size_t> &a,
+               const std::pair<uintmax_t, size_t> &b) {
+              return a.first > b.first;
+            });
+  work_stealing_queues queues(summary.workers);
+  for (size_t i = 0; i < by_size.size(); ++i) {
+    queues.push(i % summary.workers, by_size[i].second);
+  }
+
+  LOG(INFO) << "Converting " << inputs.size() << " files with "
+            << summary.workers << " workers.";
+
+  // Files are spread over workers already, so meshes of a file are extracted
+  // on the worker thread itself.
+  loader::options file_opts = opts;
+  file_opts.jobs = 1;
+
+  auto worker = [&](size_t worker_index) {
+    Assimp::Importer importer;
+    size_t item;
+    while (queues.pop(worker_index, item)) {
+      batch_result &result = summary.results[item];
+      result.worker = worker_index;
+      convert_file(importer, inputs[item].file, inputs[item].name,
+                   file_opts, result);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < summary.workers; ++i) {
+    threads.emplace_back(worker, i);
+  }
+  worker(0);
+  for (std::thread &t : threads) {
+    t.join();
+  }
+
+  for (const batch_result &r : summary.results) {
+    if (r.cached) {
+      summary.cached++;
+    }
+    if (r.success) {
+      summary.succeeded++;
+    } else {
+      summary.failed++;
+      LOG(ERROR) << "FAILED " << r.file << ": " << r.error;
+    }
+  }
+  summary.seconds =
+      std::chrono::duration<double>(clock::now() - batch_start).count();
+
+  LOG(INFO) << "Batch done: " << summary.succeeded << " succeeded, "
+            << summary.failed << " failed, " << summary.cached
+            << " from cache, " << summary.seconds << "s.";
+
+  if (!opts.stats_file.empty()) {
+    std::vector<conversion_stats> stats;
+    for (const batch_result &r : summary.results) {
+      stats.push_back(r.stats);
+    }
+    write_stats_report(opts.stats_file, stats);
+  }
+
+  const std::string summary_filename = "./output/batch-summary.json";
+  boost::system::error_code ec;
+  boost::filesystem::create_directories("./output", ec);
+  std::ofstream summary_file(summary_filename);
+  if (summary_file) {
+    cereal::JSONOutputArchive archive(summary_file);
+    archive(cereal::make_nvp("batch", summary));
+  } else {
+    LOG(ERROR) << "Could not write " << summary_filename;
+  }
+  return summary.failed == 0;
+}
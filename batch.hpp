@@ -0,0 +1,94 @@
+// Converts many files in one process, see run_batch.
+
+#pragma once
+
+#include "conversion_stats.hpp"
+#include "loader.hpp"
+
+#include <deque>
+#include <memory>
+#include <mutex>
+
+// Per-worker queues of item indices. A worker takes from the front of its own
+// queue and, once that is empty, steals from the back of the others.
+class work_stealing_queues {
+public:
+  explicit work_stealing_queues(size_t workers);
+
+  void push(size_t worker, size_t item);
+
+  // Returns false once every queue is empty.
+  bool pop(size_t worker, size_t &item);
+
+protected:
+  struct queue {
+    std::mutex mutex;
+    std::deque<size_t> items;
+  };
+  std::vector<std::unique_ptr<queue>> queues;
+};
+
+struct batch_result {
+  std::string file;
+  bool success = false;
+  // Outputs were restored from the conversion cache.
+  bool cached = false;
+  double seconds = 0.0;
+  size_t worker = 0;
+  std::string error;
+  // For --stats, kept out of the batch summary.
+  conversion_stats stats;
+
+  template <class Archive> void serialize(Archive &archive) {
+    archive(CEREAL_NVP(file), CEREAL_NVP(success), CEREAL_NVP(cached),
+            CEREAL_NVP(seconds), CEREAL_NVP(worker), CEREAL_NVP(error));
+  }
+};
+
+struct batch_summary {
+  size_t files = 0;
+  size_t succeeded = 0;
+  size_t failed = 0;
+  size_t cached = 0;
+  size_t workers = 0;
+  double seconds = 0.0;
+  std::vector<batch_result> results;
+
+  template <class Archive> void serialize(Archive &archive) {
+    archive(CEREAL_NVP(files), CEREAL_NVP(succeeded), CEREAL_NVP(failed),
+            CEREAL_NVP(cached), CEREAL_NVP(workers), CEREAL_NVP(seconds),
+            CEREAL_NVP(results));
+  }
+};
+
+// Converts a single file with `importer`, writing its outputs to
+// loader::output_path_for(name). When opts.cache_dir is set, a cache hit
+// restores the previous outputs without loading the scene, and a successful
+// conversion is stored for next time. Fills in everything but
+// result.worker.
+void convert_file(Assimp::Importer &importer, const std::string &file,
+                  const std::string &name, const loader::options &opts,
+                  batch_result &result);
+
+struct batch_input {
+  std::string file;
+  // Path of the file relative to the batch source root, which names its
+  // outputs.
+  std::string name;
+};
+
+// Lists the files to convert. `source` is either a directory, searched
+// recursively for extensions Assimp can import, or a manifest with one path
+// per line ('#' starts a comment, relative paths are relative to the
+// manifest). The root is the directory, or the one holding the manifest;
+// manifest entries outside it are rejected, since their outputs would land
+// outside ./output.
+bool collect_batch_inputs(const std::string &source,
+                          std::vector<batch_input> &inputs);
+
+// Converts every input of `source` with opts.jobs workers, each keeping its
+// own Assimp::Importer for the whole run. The largest files are started
+// first. Prints a summary and writes it to ./output/batch-summary.json, and
+// the stats of every file to opts.stats_file if set. Returns false if any
+// file failed.
+bool run_batch(const std::string &source, const loader::options &opts);
@@ -0,0 +1,481 @@
+// Times each stage of loader::load on procedurally generated scenes, so that
+// the cost of the different asset classes can be tracked over time. Results
+// are printed and written as JSON, see README.
+
+#include "loader.hpp"
+#include "memory_stats.hpp"
+#include "parse_size.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+struct bench_params {
+  std::string name = "custom";
+  size_t meshes = 1;
+  size_t vertices = 10000; // Per mesh, rounded to a grid.
+  size_t bones_per_vertex = 4;
+  // Joints form a tree of this many levels, each joint having `width`
+  // children. A depth of 0 means no skeleton.
+  size_t skeleton_depth = 4;
+  size_t skeleton_width = 3;
+  size_t animations = 1;
+  size_t keys = 30; // Per channel, for translation, rotation and scale each.
+
+  template <class Archive> void serialize(Archive &archive) {
+    archive(CEREAL_NVP(name), CEREAL_NVP(meshes), CEREAL_NVP(vertices),
+            CEREAL_NVP(bones_per_vertex), CEREAL_NVP(skeleton_depth),
+            CEREAL_NVP(skeleton_width), CEREAL_NVP(animations),
+            CEREAL_NVP(keys));
+  }
+};
+
+struct bench_case_result {
+  bench_params params;
+  size_t vertex_count = 0;
+  size_t triangle_count = 0;
+  size_t joint_count = 0;
+  bool success = false;
+  // Fastest run, and fastest time of each stage over all runs.
+  double total_seconds = 0.0;
+  std::vector<stage_timing> stages;
+  // Peak memory of a single conversion, without and with --stream.
+  size_t peak_rss_bytes = 0;
+  size_t stream_peak_rss_bytes = 0;
+
+  template <class Archive> void serialize(Archive &archive) {
+    archive(CEREAL_NVP(params), CEREAL_NVP(vertex_count),
+            CEREAL_NVP(triangle_count), CEREAL_NVP(joint_count),
+            CEREAL_NVP(success), CEREAL_NVP(total_seconds), CEREAL_NVP(stages),
+            CEREAL_NVP(peak_rss_bytes), CEREAL_NVP(stream_peak_rss_bytes));
+  }
+};
+
+struct bench_results {
+  std::string version = MESH_IMPORTER_VERSION;
+  std::string format;
+  size_t jobs = 1;
+  size_t runs = 1;
+  std::vector<bench_case_result> cases;
+
+  template <class Archive> void serialize(Archive &archive) {
+    archive(CEREAL_NVP(version), CEREAL_NVP(format), CEREAL_NVP(jobs),
+            CEREAL_NVP(runs), CEREAL_NVP(cases));
+  }
+};
+
+// Representative asset classes, run when no scene parameter is given.
+std::vector<bench_params> default_cases() {
+  std::vector<bench_params> cases(4);
+  cases[0].name = "props";
+  cases[0].meshes = 200;
+  cases[0].vertices = 2000;
+  cases[0].bones_per_vertex = 0;
+  cases[0].skeleton_depth = 0;
+  cases[0].animations = 0;
+
+  cases[1].name = "character";
+  cases[1].meshes = 8;
+  cases[1].vertices = 20000;
+  cases[1].skeleton_depth = 7;
+  cases[1].skeleton_width = 2;
+  cases[1].animations = 4;
+  cases[1].keys = 60;
+
+  cases[2].name = "animation_heavy";
+  cases[2].meshes = 1;
+  cases[2].vertices = 1000;
+  cases[2].bones_per_vertex = 2;
+  cases[2].skeleton_depth = 4;
+  cases[2].skeleton_width = 6;
+  cases[2].animations = 20;
+  cases[2].keys = 240;
+
+  // Where --stream matters: many large meshes.
+  cases[3].name = "large_scene";
+  cases[3].meshes = 64;
+  cases[3].vertices = 40000;
+  cases[3].bones_per_vertex = 0;
+  cases[3].skeleton_depth = 0;
+  cases[3].animations = 0;
+  return cases;
+}
+
+// Adds `depth` levels of joints under `parent`, named in depth-first order.
+void add_joints(aiNode *parent, size_t depth, size_t width,
+                std::vector<aiNode *> &joints) {
+  if (depth == 0) {
+    return;
+  }
+  parent->mNumChildren = static_cast<unsigned int>(width);
+  parent->mChildren = new aiNode *[width];
+  for (size_t c = 0; c < width; ++c) {
+    aiNode *joint = new aiNode();
+    joint->mName.Set("joint_" + std::to_string(joints.size()));
+    // One unit along the parent's Y axis.
+    joint->mTransformation.b4 = 1.0f;
+    joint->mParent = parent;
+    parent->mChildren[c] = joint;
+    joints.push_back(joint);
+    add_joints(joint, depth - 1, width, joints);
+  }
+}
+
+aiMesh *make_mesh(const bench_params &params, size_t mesh_num,
+                  const std::vector<aiNode *> &joints) {
+  const size_t cols =
+      std::max<size_t>(2, static_cast<size_t>(std::sqrt(params.vertices)));
+  const size_t rows = std::max<size_t>(2, params.vertices / cols);
+  const size_t num_verts = rows * cols;
+  const size_t num_faces = (rows - 1) * (cols - 1) * 2;
+
+  aiMesh *mesh = new aiMesh();
+  mesh->mName.Set("mesh_" + std::to_string(mesh_num));
+  mesh->mPrimitiveTypes = aiPrimitiveType_TRIANGLE;
+  mesh->mNumVertices = static_cast<unsigned int>(num_verts);
+  mesh->mVertices = new aiVector3D[num_verts];
+  mesh->mNormals = new aiVector3D[num_verts];
+  mesh->mTextureCoords[0] = new aiVector3D[num_verts];
+  mesh->mNumUVComponents[0] = 2;
+  for (size_t r = 0; r < rows; ++r) {
+    for (size_t c = 0; c < cols; ++c) {
+      const float u = float(c) / (cols - 1), v = float(r) / (rows - 1);
+      const size_t n = r * cols + c;
+      // A gently rolling sheet, so that simplification has work to do.
+      const float height = 0.05f * std::sin(u * 12.0f) * std::cos(v * 9.0f);
+      mesh->mVertices[n] = aiVector3D(u + float(mesh_num), v, height);
+      mesh->mNormals[n] = aiVector3D(0.0f, 0.0f, 1.0f);
+      mesh->mTextureCoords[0][n] = aiVector3D(u, v, 0.0f);
+    }
+  }
+
+  mesh->mNumFaces = static_cast<unsigned int>(num_faces);
+  mesh->mFaces = new aiFace[num_faces];
+  size_t f = 0;
+  for (size_t r = 0; r + 1 < rows; ++r) {
+    for (size_t c = 0; c + 1 < cols; ++c) {
+      const unsigned int i0 = static_cast<unsigned int>(r * cols + c);
+      const unsigned int i2 = static_cast<unsigned int>(i0 + cols);
+      const unsigned int i1 = i0 + 1, i3 = i2 + 1;
+      const unsigned int quad[2][3] = {{i0, i1, i3}, {i0, i3, i2}};
+      for (const unsigned int(&tri)[3] : quad) {
+        aiFace &face = mesh->mFaces[f++];
+        face.mNumIndices = 3;
+        face.mIndices = new unsigned int[3];
+        std::copy(tri, tri + 3, face.mIndices);
+      }
+    }
+  }
+
+  const size_t bones_per_vertex =
+      std::min(params.bones_per_vertex, joints.size());
+  if (bones_per_vertex == 0) {
+    return mesh;
+  }
+  // Neighbouring vertices share joints, as they would on a real skin.
+  std::vector<std::vector<aiVertexWeight>> weights(joints.size());
+  const float weight_sum =
+      float(bones_per_vertex * (bones_per_vertex + 1)) / 2.0f;
+  for (size_t n = 0; n < num_verts; ++n) {
+    const size_t base = n * joints.size() / num_verts;
+    for (size_t k = 0; k < bones_per_vertex; ++k) {
+      weights[(base + k) % joints.size()].push_back(aiVertexWeight(
+          static_cast<unsigned int>(n), (bones_per_vertex - k) / weight_sum));
+    }
+  }
+  std::vector<aiBone *> bones;
+  for (size_t j = 0; j < joints.size(); ++j) {
+    if (weights[j].empty()) {
+      continue;
+    }
+    aiBone *bone = new aiBone();
+    bone->mName = joints[j]->mName;
+    bone->mNumWeights = static_cast<unsigned int>(weights[j].size());
+    bone->mWeights = new aiVertexWeight[weights[j].size()];
+    std::copy(weights[j].begin(), weights[j].end(), bone->mWeights);
+    bones.push_back(bone);
+  }
+  mesh->mNumBones = static_cast<unsigned int>(bones.size());
+  mesh->mBones = new aiBone *[bones.size()];
+  std::copy(bones.begin(), bones.end(), mesh->mBones);
+  return mesh;
+}
+
+aiAnimation *make_animation(const bench_params &params, size_t anim_num,
+                            const std::vector<aiNode *> &joints) {
+  const double ticks_per_second = 30.0;
+  aiAnimation *anim = new aiAnimation();
+  anim->mName.Set("anim_" + std::to_string(anim_num));
+  anim->mDuration = double(params.keys - 1);
+  anim->mTicksPerSecond = ticks_per_second;
+  anim->mNumChannels = static_cast<unsigned int>(joints.size());
+  anim->mChannels = new aiNodeAnim *[joints.size()];
+  for (size_t j = 0; j < joints.size(); ++j) {
+    aiNodeAnim *channel = new aiNodeAnim();
+    channel->mNodeName = joints[j]->mName;
+    channel->mNumPositionKeys = static_cast<unsigned int>(params.keys);
+    channel->mNumRotationKeys = static_cast<unsigned int>(params.keys);
+    channel->mNumScalingKeys = static_cast<unsigned int>(params.keys);
+    channel->mPositionKeys = new aiVectorKey[params.keys];
+    channel->mRotationKeys = new aiQuatKey[params.keys];
+    channel->mScalingKeys = new aiVectorKey[params.keys];
+    for (size_t k = 0; k < params.keys; ++k) {
+      const double t = double(k);
+      const float phase = float(t * 0.2 + j + anim_num);
+      channel->mPositionKeys[k].mTime = t;
+      channel->mPositionKeys[k].mValue =
+          aiVector3D(0.0f, 1.0f + 0.01f * std::sin(phase), 0.0f);
+      channel->mRotationKeys[k].mTime = t;
+      const float half_angle = 0.2f * std::sin(phase);
+      channel->mRotationKeys[k].mValue =
+          aiQuaternion(std::cos(half_angle), 0.0f, 0.0f, std::sin(half_angle));
+      channel->mScalingKeys[k].mTime = t;
+      channel->mScalingKeys[k].mValue = aiVector3D(1.0f, 1.0f, 1.0f);
+    }
+    anim->mChannels[j] = channel;
+  }
+  return anim;
+}
+
+std::unique_ptr<aiScene> make_scene(const bench_params &params,
+                                    size_t &joint_count) {
+  std::unique_ptr<aiScene> scene(new aiScene());
+  scene->mRootNode = new aiNode();
+  scene->mRootNode->mName.Set("bench_root");
+
+  // The root joint, then its descendants.
+  std::vector<aiNode *> joints;
+  if (params.skeleton_depth > 0) {
+    add_joints(scene->mRootNode, 1, 1, joints);
+    add_joints(joints[0], params.skeleton_depth - 1, params.skeleton_width,
+               joints);
+  }
+  joint_count = joints.size();
+
+  scene->mNumMeshes = static_cast<unsigned int>(params.meshes);
+  scene->mMeshes = new aiMesh *[params.meshes];
+  for (size_t m = 0; m < params.meshes; ++m) {
+    scene->mMeshes[m] = make_mesh(params, m, joints);
+  }
+
+  // Ozz needs a duration, so animations have at least two keys.
+  if (!joints.empty() && params.keys >= 2 && params.animations > 0) {
+    scene->mNumAnimations = static_cast<unsigned int>(params.animations);
+    scene->mAnimations = new aiAnimation *[params.animations];
+    for (size_t a = 0; a < params.animations; ++a) {
+      scene->mAnimations[a] = make_animation(params, a, joints);
+    }
+  }
+  return scene;
+}
+
+// Peak memory of one conversion of `params`, or 0 if it failed. Each runs in
+// a child process, since the peak of this one only ever grows.
+size_t measure_peak_rss(const bench_params &params, loader::options opts,
+                        bool stream) {
+  opts.stream_meshes = stream;
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return 0;
+  }
+  const pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    size_t joint_count = 0;
+    std::unique_ptr<aiScene> scene = make_scene(params, joint_count);
+    loader l(opts);
+    size_t peak = 0;
+    if (l.load(scene.get(), "bench/" + params.name)) {
+      peak = peak_rss_bytes();
+    }
+    const bool sent = write(fds[1], &peak, sizeof(peak)) == sizeof(peak);
+    _exit(sent ? 0 : 1);
+  }
+  close(fds[1]);
+  size_t peak = 0;
+  if (pid < 0 || read(fds[0], &peak, sizeof(peak)) != sizeof(peak)) {
+    peak = 0;
+  }
+  close(fds[0]);
+  if (pid > 0) {
+    waitpid(pid, nullptr, 0);
+  }
+  return peak;
+}
+
+bool run_case(const bench_params &params, const loader::options &opts,
+              size_t runs, bench_case_result &result) {
+  result.params = params;
+  // Measured first, while this process holds no scene that children would
+  // start with.
+  result.peak_rss_bytes = measure_peak_rss(params, opts, false);
+  result.stream_peak_rss_bytes = measure_peak_rss(params, opts, true);
+  std::unique_ptr<aiScene> scene = make_scene(params, result.joint_count);
+  for (size_t m = 0; m < scene->mNumMeshes; ++m) {
+    result.vertex_count += scene->mMeshes[m]->mNumVertices;
+    result.triangle_count += scene->mMeshes[m]->mNumFaces;
+  }
+
+  for (size_t run = 0; run < runs; ++run) {
+    loader l(opts);
+    const stage_timings::clock::time_point start =
+        stage_timings::clock::now();
+    const bool success = l.load(scene.get(), "bench/" + params.name);
+    const double seconds = stage_timings::seconds_since(start);
+    if (!success) {
+      std::cout << "Case " << params.name << " failed to convert."
+                << std::endl;
+      return false;
+    }
+
+    if (run == 0 || seconds < result.total_seconds) {
+      result.total_seconds = seconds;
+    }
+    for (const stage_timing &t : l.get_stage_timings()) {
+      auto it = std::find_if(
+          result.stages.begin(), result.stages.end(),
+          [&](const stage_timing &s) { return s.stage == t.stage; });
+      if (it == result.stages.end()) {
+        result.stages.push_back(t);
+      } else {
+        // Allocations do not vary between runs, only time does.
+        it->seconds = std::min(it->seconds, t.seconds);
+      }
+    }
+  }
+  result.success = true;
+  return true;
+}
+
+void print_case(const bench_case_result &result) {
+  std::cout << result.params.name << ": " << result.params.meshes
+            << " meshes, " << result.vertex_count << " vertices, "
+            << result.triangle_count << " triangles, " << result.joint_count
+            << " joints, " << result.params.animations << " animations of "
+            << result.params.keys << " keys. Total " << result.total_seconds
+            << "s." << std::endl;
+  std::cout << "  Peak memory " << result.peak_rss_bytes / (1024 * 1024)
+            << " MiB, " << result.stream_peak_rss_bytes / (1024 * 1024)
+            << " MiB with --stream." << std::endl;
+  for (const stage_timing &t : result.stages) {
+    std::cout << "  " << std::left << std::setw(20) << t.stage << std::right
+              << std::fixed << std::setprecision(6) << t.seconds << "s"
+              << std::defaultfloat << std::endl;
+  }
+}
+
+void print_usage() {
+  std::cout << "Usage: mesh_importer_bench [--runs N] [--jobs N] "
+               "[--format json|capnp|ozzmesh] [--out <file>]"
+            << std::endl;
+  std::cout << "  [--meshes N] [--vertices N] [--bones-per-vertex N] "
+               "[--skeleton-depth N] [--skeleton-width N] [--animations N] "
+               "[--keys N]"
+            << std::endl;
+  std::cout << "Without scene parameters, runs the props, character, "
+               "animation_heavy and large_scene cases."
+            << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  loader::options opts;
+  // One thread by default, so that stage times are not spread over workers.
+  opts.jobs = 1;
+  bench_results results;
+  results.format = "json";
+  std::string out_filename = "output/bench/results.json";
+  bench_params custom;
+  bool has_custom = false;
+
+  const struct {
+    const char *flag;
+    size_t bench_params::*value;
+  } scene_flags[] = {
+      {"--meshes", &bench_params::meshes},
+      {"--vertices", &bench_params::vertices},
+      {"--bones-per-vertex", &bench_params::bones_per_vertex},
+      {"--skeleton-depth", &bench_params::skeleton_depth},
+      {"--skeleton-width", &bench_params::skeleton_width},
+      {"--animations", &bench_params::animations},
+      {"--keys", &bench_params::keys},
+  };
+
+  for (int i = 1; i < argc; ++i) {
+    bool matched = false;
+    for (const auto &f : scene_flags) {
+      if (std::strcmp(argv[i], f.flag) == 0 && i + 1 < argc) {
+        if (!parse_size(argv[++i], custom.*f.value)) {
+          print_usage();
+          return -1;
+        }
+        has_custom = matched = true;
+      }
+    }
+    if (matched) {
+      continue;
+    }
+    if (std::strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+      if (!parse_size(argv[++i], results.runs)) {
+        print_usage();
+        return -1;
+      }
+      results.runs = std::max<size_t>(1, results.runs);
+    } else if (std::strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      if (!parse_size(argv[++i], opts.jobs)) {
+        print_usage();
+        return -1;
+      }
+    } else if (std::strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+      results.format = argv[++i];
+      if (results.format == "json") {
+        opts.format = loader::output_format::JSON;
+      } else if (results.format == "capnp") {
+        opts.format = loader::output_format::CAPNP;
+      } else if (results.format == "ozzmesh") {
+        opts.format = loader::output_format::OZZMESH;
+      } else {
+        print_usage();
+        return -1;
+      }
+    } else if (std::strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+      out_filename = argv[++i];
+    } else {
+      print_usage();
+      return -1;
+    }
+  }
+  results.jobs = opts.jobs;
+
+  const std::vector<bench_params> cases =
+      has_custom ? std::vector<bench_params>(1, custom) : default_cases();
+  bool success = true;
+  for (const bench_params &params : cases) {
+    bench_case_result result;
+    success = run_case(params, opts, results.runs, result) && success;
+    print_case(result);
+    results.cases.push_back(result);
+  }
+
+  std::ofstream out_file(out_filename);
+  if (!out_file) {
+    std::cout << "Could not write " << out_filename << std::endl;
+    return -2;
+  }
+  {
+    cereal::JSONOutputArchive archive(out_file);
+    archive(cereal::make_nvp("bench", results));
+  }
+  std::cout << "Results written to " << out_filename << std::endl;
+  return success ? 0 : -2;
+}
@@ -0,0 +1,80 @@
+#include "bounds.hpp"
+
+#include <algorithm>
+#include <limits>
+
+loader::SerializedBounds empty_bounds() {
+  const float max = std::numeric_limits<float>::max();
+  loader::SerializedBounds bounds;
+  bounds.min = {{max, max, max}};
+  bounds.max = {{-max, -max, -max}};
+  return bounds;
+}
+
+bool is_empty(const loader::SerializedBounds &bounds) {
+  return bounds.min[0] > bounds.max[0] || bounds.min[1] > bounds.max[1] ||
+         bounds.min[2] > bounds.max[2];
+}
+
+void grow_bounds(loader::SerializedBounds &bounds,
+                 const std::array<float, 3> &point) {
+  for (size_t i = 0; i < 3; ++i) {
+    bounds.min[i] = std::min(bounds.min[i], point[i]);
+    bounds.max[i] = std::max(bounds.max[i], point[i]);
+  }
+}
+
+void grow_bounds(loader::SerializedBounds &bounds,
+                 const loader::SerializedBounds &other) {
+  if (!is_empty(other)) {
+    grow_bounds(bounds, other.min);
+    grow_bounds(bounds, other.max);
+  }
+}
+
+std::array<float, 3> bounds_dimensions(const loader::SerializedBounds &bounds) {
+  std::array<float, 3> dimensions = {{0.0f, 0.0f, 0.0f}};
+  if (!is_empty(bounds)) {
+    for (size_t i = 0; i < 3; ++i) {
+      dimensions[i] = bounds.max[i] - bounds.min[i];
+    }
+  }
+  return dimensions;
+}
+
+loader::SerializedBounds
+compute_bounds(const std::vector<std::array<float, 3>> &positions) {
+  loader::SerializedBounds bounds = empty_bounds();
+  for (const std::array<float, 3> &p : positions) {
+    grow_bounds(bounds, p);
+  }
+  return bounds;
+}
+
+std::vector<loader::SerializedBounds>
+compute_joint_bounds(const loader::SerializedMesh &mesh, float min_weight) {
+  std::vector<loader::SerializedBounds> bounds(mesh.bone_names.size(),
+                                               empty_bounds());
+  for (size_t v = 0; v < mesh.bone_weights.size(); ++v) {
+    const std::array<float, 4> &weights = mesh.bone_weights[v];
+    const size_t heaviest =
+        std::max_element(weights.begin(), weights.end()) - weights.begin();
+    for (size_t i = 0; i < 4; ++i) {
+      const uint32_t joint = mesh.bone_indices[v][i];
+      if (weights[i] <= 0.0f || (weights[i] < min_weight && i != heaviest) ||
+          joint >= bounds.size() ||
+          joint >= mesh.inverse_bind_matrices.size()) {
+        continue;
+      }
+      // Column-major, element (r, c) at c * 4 + r.
+      const std::array<float, 16> &m = mesh.inverse_bind_matrices[joint];
+      const std::array<float, 3> &p = mesh.positions[v];
+      std::array<float, 3> local;
+      for (size_t r = 0; r < 3; ++r) {
+        local[r] = m[r] * p[0] + m[4 + r] * p[1] + m[8 + r] * p[2] + m[12 + r];
+      }
+      grow_bounds(bounds[joint], local);
+    }
+  }
+  return bounds;
+}
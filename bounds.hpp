@@ -0,0 +1,36 @@
+// Bounding boxes of meshes, and of the vertices each joint moves so that an
+// animated character can be bounded by transforming one box per joint
+// instead of skinning its vertices.
+
+#pragma once
+
+#include "loader.hpp"
+
+// A box that contains nothing yet, min greater than max.
+loader::SerializedBounds empty_bounds();
+
+bool is_empty(const loader::SerializedBounds &bounds);
+
+void grow_bounds(loader::SerializedBounds &bounds,
+                 const std::array<float, 3> &point);
+
+void grow_bounds(loader::SerializedBounds &bounds,
+                 const loader::SerializedBounds &other);
+
+// Size of the box along each axis, 0 when empty.
+std::array<float, 3> bounds_dimensions(const loader::SerializedBounds &bounds);
+
+loader::SerializedBounds
+compute_bounds(const std::vector<std::array<float, 3>> &positions);
+
+// One box per entry of mesh.bone_names, in the bind space of that joint (ie
+// the vertices transformed by its inverse bind matrix), holding the vertices
+// it weighs at least `min_weight` on. A vertex is also always in the box of
+// its heaviest joint, so that every vertex is in some box. Joints moving no
+// vertex get an empty box. Transformed by the model space matrices of their
+// joints, the boxes bound the animated mesh, up to the light influences
+// left out.
+//
+// Must run once bone_indices refer to skeleton joints, before palettes.
+std::vector<loader::SerializedBounds>
+compute_joint_bounds(const loader::SerializedMesh &mesh, float min_weight);
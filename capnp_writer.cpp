@@ -0,0 +1,247 @@
+#include "capnp_writer.hpp"
+
+#include "model3d_schema.capnp.h"
+#include <capnp/message.h>
+#include <capnp/serialize.h>
+
+#include <algorithm>
+
+namespace {
+
+// Copies per-vertex arrays into a flat list (xyzxyz...).
+template <typename ListBuilder, typename T, size_t N>
+void fill_flat_list(ListBuilder list,
+                    const std::vector<std::array<T, N>> &source) {
+  for (size_t i = 0; i < source.size(); ++i) {
+    for (size_t j = 0; j < N; ++j) {
+      list.set(static_cast<capnp::uint>(i * N + j), source[i][j]);
+    }
+  }
+}
+
+template <typename ListBuilder>
+void fill_submeshes(ListBuilder list,
+                    const std::vector<loader::SerializedSubmesh> &source) {
+  for (size_t i = 0; i < source.size(); ++i) {
+    Submesh::Builder submesh = list[static_cast<capnp::uint>(i)];
+    submesh.setIndexOffset(source[i].index_offset);
+    submesh.setIndexCount(source[i].index_count);
+    capnp::List<uint32_t>::Builder palette = submesh.initPalette(
+        static_cast<capnp::uint>(source[i].palette.size()));
+    for (size_t j = 0; j < source[i].palette.size(); ++j) {
+      palette.set(static_cast<capnp::uint>(j), source[i].palette[j]);
+    }
+  }
+}
+
+template <typename ListBuilder>
+void fill_ranges(ListBuilder list,
+                 const std::vector<loader::SerializedRange> &source) {
+  for (size_t i = 0; i < source.size(); ++i) {
+    Range::Builder range = list[static_cast<capnp::uint>(i)];
+    range.setName(source[i].name.c_str());
+    range.setIndexOffset(source[i].index_offset);
+    range.setIndexCount(source[i].index_count);
+    range.setVertexOffset(source[i].vertex_offset);
+    range.setVertexCount(source[i].vertex_count);
+    range.setShortIndices(source[i].short_indices);
+  }
+}
+
+void fill_meshlets(capnp::List<Meshlet>::Builder list,
+                   const std::vector<loader::SerializedMeshlet> &source) {
+  for (size_t i = 0; i < source.size(); ++i) {
+    const loader::SerializedMeshlet &m = source[i];
+    Meshlet::Builder meshlet = list[static_cast<capnp::uint>(i)];
+    meshlet.setIndexOffset(m.index_offset);
+    meshlet.setIndexCount(m.index_count);
+    meshlet.setVertexCount(m.vertex_count);
+    meshlet.setCenterX(m.center[0]);
+    meshlet.setCenterY(m.center[1]);
+    meshlet.setCenterZ(m.center[2]);
+    meshlet.setRadius(m.radius);
+    meshlet.setConeAxisX(m.cone_axis[0]);
+    meshlet.setConeAxisY(m.cone_axis[1]);
+    meshlet.setConeAxisZ(m.cone_axis[2]);
+    meshlet.setConeCutoff(m.cone_cutoff);
+  }
+}
+
+// Rough size of the message in words, so that MallocMessageBuilder can put
+// everything in one segment instead of growing through many small ones.
+size_t estimate_words(const loader::SerializedModel &model) {
+  size_t bytes = 0;
+  for (const loader::SerializedMesh &m : model.meshes) {
+    bytes += 256 + m.name.size();
+    bytes += m.positions.size() * sizeof(m.positions[0]);
+    bytes += m.normals.size() * sizeof(m.normals[0]);
+    bytes += m.uvs.size() * sizeof(m.uvs[0]);
+    bytes += m.bone_indices.size() * sizeof(m.bone_indices[0]);
+    bytes += m.bone_weights.size() * sizeof(m.bone_weights[0]);
+    bytes += m.inverse_bind_matrices.size() *
+             sizeof(m.inverse_bind_matrices[0]);
+    bytes += m.indices.size() * sizeof(m.indices[0]);
+    bytes += m.meshlets.size() * 48;
+    bytes += m.joint_bounds.size() * sizeof(m.joint_bounds[0]);
+    for (const loader::SerializedLod &lod : m.lods) {
+      bytes += 32 + lod.indices.size() * sizeof(lod.indices[0]);
+      for (const loader::SerializedSubmesh &s : lod.submeshes) {
+        bytes += 32 + s.palette.size() * sizeof(s.palette[0]);
+      }
+      for (const loader::SerializedRange &r : lod.ranges) {
+        bytes += 48 + r.name.size();
+      }
+    }
+    for (const loader::SerializedSubmesh &s : m.submeshes) {
+      bytes += 32 + s.palette.size() * sizeof(s.palette[0]);
+    }
+    for (const loader::SerializedRange &r : m.ranges) {
+      bytes += 48 + r.name.size();
+    }
+    for (const std::string &s : m.bone_names) {
+      bytes += 16 + s.size();
+    }
+  }
+  for (const loader::SerializedMaterial &m : model.materials) {
+    bytes += 64 + m.name.size() + m.diffuse_texture_path.size() +
+             m.normals_texture_path.size() + m.specular_texture_path.size();
+  }
+  return bytes / sizeof(capnp::word) + 1024;
+}
+
+} // namespace
+
+bool write_capnp_model(const loader::SerializedModel &model,
+                       ozz::io::Stream &stream) {
+  const size_t estimate = estimate_words(model);
+  capnp::MallocMessageBuilder message(
+      static_cast<capnp::uint>(std::min<size_t>(estimate, 1u << 28)));
+  Model::Builder root = message.initRoot<Model>();
+
+  capnp::List<Mesh>::Builder meshes =
+      root.initMeshes(static_cast<capnp::uint>(model.meshes.size()));
+  for (size_t i = 0; i < model.meshes.size(); ++i) {
+    const loader::SerializedMesh &m = model.meshes[i];
+    Mesh::Builder mesh = meshes[static_cast<capnp::uint>(i)];
+    mesh.setName(m.name.c_str());
+    mesh.setTranslationX(m.translation[0]);
+    mesh.setTranslationY(m.translation[1]);
+    mesh.setTranslationZ(m.translation[2]);
+    mesh.setScaleX(m.scale[0]);
+    mesh.setScaleY(m.scale[1]);
+    mesh.setScaleZ(m.scale[2]);
+    mesh.setDimensionsX(m.dimensions[0]);
+    mesh.setDimensionsY(m.dimensions[1]);
+    mesh.setDimensionsZ(m.dimensions[2]);
+    mesh.setBoundsMinX(m.bounds.min[0]);
+    mesh.setBoundsMinY(m.bounds.min[1]);
+    mesh.setBoundsMinZ(m.bounds.min[2]);
+    mesh.setBoundsMaxX(m.bounds.max[0]);
+    mesh.setBoundsMaxY(m.bounds.max[1]);
+    mesh.setBoundsMaxZ(m.bounds.max[2]);
+    mesh.setRotationX(m.rotation[0]);
+    mesh.setRotationY(m.rotation[1]);
+    mesh.setRotationZ(m.rotation[2]);
+    mesh.setRotationW(m.rotation[3]);
+    mesh.setMaterialIndex(m.material_index);
+
+    capnp::List<uint32_t>::Builder indices =
+        mesh.initIndices(static_cast<capnp::uint>(m.indices.size()));
+    for (size_t j = 0; j < m.indices.size(); ++j) {
+      indices.set(static_cast<capnp::uint>(j), m.indices[j]);
+    }
+    capnp::List<Lod>::Builder lods =
+        mesh.initLods(static_cast<capnp::uint>(m.lods.size()));
+    for (size_t j = 0; j < m.lods.size(); ++j) {
+      const loader::SerializedLod &l = m.lods[j];
+      Lod::Builder lod = lods[static_cast<capnp::uint>(j)];
+      lod.setError(l.error);
+      lod.setRelativeError(l.relative_error);
+      capnp::List<uint32_t>::Builder lod_indices =
+          lod.initIndices(static_cast<capnp::uint>(l.indices.size()));
+      for (size_t k = 0; k < l.indices.size(); ++k) {
+        lod_indices.set(static_cast<capnp::uint>(k), l.indices[k]);
+      }
+      fill_submeshes(lod.initSubmeshes(
+                         static_cast<capnp::uint>(l.submeshes.size())),
+                     l.submeshes);
+      fill_ranges(
+          lod.initRanges(static_cast<capnp::uint>(l.ranges.size())),
+          l.ranges);
+    }
+    fill_submeshes(
+        mesh.initSubmeshes(static_cast<capnp::uint>(m.submeshes.size())),
+        m.submeshes);
+    fill_ranges(mesh.initRanges(static_cast<capnp::uint>(m.ranges.size())),
+                m.ranges);
+    fill_meshlets(
+        mesh.initMeshlets(static_cast<capnp::uint>(m.meshlets.size())),
+        m.meshlets);
+    capnp::List<float>::Builder joint_bounds = mesh.initJointBounds(
+        static_cast<capnp::uint>(m.joint_bounds.size() * 6));
+    for (size_t j = 0; j < m.joint_bounds.size(); ++j) {
+      for (size_t k = 0; k < 3; ++k) {
+        joint_bounds.set(static_cast<capnp::uint>(j * 6 + k),
+                         m.joint_bounds[j].min[k]);
+        joint_bounds.set(static_cast<capnp::uint>(j * 6 + 3 + k),
+                         m.joint_bounds[j].max[k]);
+      }
+    }
+    fill_flat_list(
+        mesh.initPositions(static_cast<capnp::uint>(m.positions.size() * 3)),
+        m.positions);
+    fill_flat_list(
+        mesh.initNormals(static_cast<capnp::uint>(m.normals.size() * 3)),
+        m.normals);
+    fill_flat_list(mesh.initUvs(static_cast<capnp::uint>(m.uvs.size() * 2)),
+                   m.uvs);
+    fill_flat_list(mesh.initBoneIndices(
+                       static_cast<capnp::uint>(m.bone_indices.size() * 4)),
+                   m.bone_indices);
+    fill_flat_list(mesh.initBoneWeights(
+                       static_cast<capnp::uint>(m.bone_weights.size() * 4)),
+                   m.bone_weights);
+    fill_flat_list(mesh.initInverseBindMatrices(static_cast<capnp::uint>(
+                       m.inverse_bind_matrices.size() * 16)),
+                   m.inverse_bind_matrices);
+
+    capnp::List<capnp::Text>::Builder bone_names =
+        mesh.initBoneNames(static_cast<capnp::uint>(m.bone_names.size()));
+    for (size_t j = 0; j < m.bone_names.size(); ++j) {
+      bone_names.set(static_cast<capnp::uint>(j), m.bone_names[j].c_str());
+    }
+  }
+
+  capnp::List<Material>::Builder materials =
+      root.initMaterials(static_cast<capnp::uint>(model.materials.size()));
+  for (size_t i = 0; i < model.materials.size(); ++i) {
+    const loader::SerializedMaterial &m = model.materials[i];
+    Material::Builder material = materials[static_cast<capnp::uint>(i)];
+    material.setName(m.name.c_str());
+    material.setDiffuseTexturePath(m.diffuse_texture_path.c_str());
+    material.setNormalsTexturePath(m.normals_texture_path.c_str());
+    material.setSpecularTexturePath(m.specular_texture_path.c_str());
+  }
+
+  // Standard stream framing: segment count - 1, each segment size in words,
+  // padded to a whole word, then the segments themselves. Written directly
+  // from the builder's segments to avoid a flat copy of the whole model.
+  kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>> segments =
+      message.getSegmentsForOutput();
+  std::vector<uint32_t> table((segments.size() + 2) & ~size_t(1), 0);
+  table[0] = static_cast<uint32_t>(segments.size() - 1);
+  for (size_t i = 0; i < segments.size(); ++i) {
+    table[i + 1] = static_cast<uint32_t>(segments[i].size());
+  }
+  const size_t table_bytes = table.size() * sizeof(uint32_t);
+  if (stream.Write(table.data(), table_bytes) != table_bytes) {
+    return false;
+  }
+  for (size_t i = 0; i < segments.size(); ++i) {
+    const size_t segment_bytes = segments[i].size() * sizeof(capnp::word);
+    if (stream.Write(segments[i].begin(), segment_bytes) != segment_bytes) {
+      return false;
+    }
+  }
+  return true;
+}
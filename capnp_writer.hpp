@@ -0,0 +1,11 @@
+// Writes a loader::SerializedModel as a Cap'n Proto message using
+// model3d_schema.capnp, so that engines can read it without parsing.
+
+#pragma once
+
+#include "loader.hpp"
+
+// Serializes the model as a single unpacked Cap'n Proto stream message
+// (segment table followed by the segments). Returns false on write failure.
+bool write_capnp_model(const loader::SerializedModel &model,
+                       ozz::io::Stream &stream);
@@ -0,0 +1,593 @@
+#include "config.hpp"
+#include "animation_optimize.hpp"
+#include "log.hpp"
+#include "parse_size.hpp"
+
+#include <assimp/config.h>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+struct named_flag {
+  const char *name;
+  unsigned int flag;
+};
+
+const named_flag import_steps[] = {
+    {"CalcTangentSpace", aiProcess_CalcTangentSpace},
+    {"JoinIdenticalVertices", aiProcess_JoinIdenticalVertices},
+    {"MakeLeftHanded", aiProcess_MakeLeftHanded},
+    {"Triangulate", aiProcess_Triangulate},
+    {"RemoveComponent", aiProcess_RemoveComponent},
+    {"GenNormals", aiProcess_GenNormals},
+    {"GenSmoothNormals", aiProcess_GenSmoothNormals},
+    {"SplitLargeMeshes", aiProcess_SplitLargeMeshes},
+    {"PreTransformVertices", aiProcess_PreTransformVertices},
+    {"LimitBoneWeights", aiProcess_LimitBoneWeights},
+    {"ValidateDataStructure", aiProcess_ValidateDataStructure},
+    {"ImproveCacheLocality", aiProcess_ImproveCacheLocality},
+    {"RemoveRedundantMaterials", aiProcess_RemoveRedundantMaterials},
+    {"FixInfacingNormals", aiProcess_FixInfacingNormals},
+    {"SortByPType", aiProcess_SortByPType},
+    {"FindDegenerates", aiProcess_FindDegenerates},
+    {"FindInvalidData", aiProcess_FindInvalidData},
+    {"GenUVCoords", aiProcess_GenUVCoords},
+    {"TransformUVCoords", aiProcess_TransformUVCoords},
+    {"FindInstances", aiProcess_FindInstances},
+    {"OptimizeMeshes", aiProcess_OptimizeMeshes},
+    {"OptimizeGraph", aiProcess_OptimizeGraph},
+    {"FlipUVs", aiProcess_FlipUVs},
+    {"FlipWindingOrder", aiProcess_FlipWindingOrder},
+    {"SplitByBoneCount", aiProcess_SplitByBoneCount},
+    {"Debone", aiProcess_Debone},
+    {"GlobalScale", aiProcess_GlobalScale},
+    {"GenBoundingBoxes", aiProcess_GenBoundingBoxes},
+};
+
+// Importer properties can be named by their macro or by its value, ie
+// AI_CONFIG_PP_LBW_MAX_WEIGHTS or PP_LBW_MAX_WEIGHTS.
+const struct {
+  const char *macro;
+  const char *name;
+} importer_properties[] = {
+    {"AI_CONFIG_PP_LBW_MAX_WEIGHTS", AI_CONFIG_PP_LBW_MAX_WEIGHTS},
+    {"AI_CONFIG_PP_SLM_VERTEX_LIMIT", AI_CONFIG_PP_SLM_VERTEX_LIMIT},
+    {"AI_CONFIG_PP_SLM_TRIANGLE_LIMIT", AI_CONFIG_PP_SLM_TRIANGLE_LIMIT},
+    {"AI_CONFIG_PP_ICL_PTCACHE_SIZE", AI_CONFIG_PP_ICL_PTCACHE_SIZE},
+    {"AI_CONFIG_PP_FD_REMOVE", AI_CONFIG_PP_FD_REMOVE},
+    {"AI_CONFIG_PP_SBBC_MAX_BONES", AI_CONFIG_PP_SBBC_MAX_BONES},
+    {"AI_CONFIG_PP_RVC_FLAGS", AI_CONFIG_PP_RVC_FLAGS},
+};
+
+// Parses a comma separated list of floats, ie "0.5,0.25".
+bool parse_floats(const std::string &list, std::vector<float> &values) {
+  values.clear();
+  std::istringstream in(list);
+  std::string item;
+  while (std::getline(in, item, ',')) {
+    char *end = nullptr;
+    const float value = std::strtof(item.c_str(), &end);
+    if (item.empty() || *end != '\0') {
+      return false;
+    }
+    values.push_back(value);
+  }
+  return !values.empty();
+}
+
+bool parse_float(const std::string &text, float &value) {
+  char *end = nullptr;
+  value = std::strtof(text.c_str(), &end);
+  return !text.empty() && *end == '\0';
+}
+
+bool set_property(const std::string &name, const std::string &value,
+                  loader::options &opts) {
+  std::string property = name;
+  for (const auto &p : importer_properties) {
+    if (name == p.macro) {
+      property = p.name;
+    }
+  }
+  char *end = nullptr;
+  const long int_value = std::strtol(value.c_str(), &end, 10);
+  if (!value.empty() && *end == '\0') {
+    opts.importer_int_properties[property] = static_cast<int>(int_value);
+    opts.importer_float_properties.erase(property);
+    return true;
+  }
+  float float_value;
+  if (parse_float(value, float_value)) {
+    opts.importer_float_properties[property] = float_value;
+    opts.importer_int_properties.erase(property);
+    return true;
+  }
+  return false;
+}
+
+typedef bool (*setting_fn)(const std::vector<std::string> &args,
+                           settings &s);
+
+struct setting {
+  const char *name;
+  size_t arg_count;
+  setting_fn apply;
+};
+
+const setting all_settings[] = {
+    {"format", 1,
+     [](const std::vector<std::string> &args, settings &s) {
+       if (args[0] == "json") {
+         s.opts.format = loader::output_format::JSON;
+       } else if (args[0] == "capnp") {
+         s.opts.format = loader::output_format::CAPNP;
+       } else if (args[0] == "ozzmesh") {
+         s.opts.format = loader::output_format::OZZMESH;
+       } else {
+         return false;
+       }
+       return true;
+     }},
+    {"jobs", 1,
+     [](const std::vector<std::string> &args, settings &s) {
+       return parse_size(args[0], s.opts.jobs);
+     }},
+    {"vertex-cache", 0,
+     [](const std::vector<std::string> &, settings &s) {
+       s.opts.optimize_vertex_cache = true;
+       return true;
+     }},
+    {"no-vertex-cache", 0,
+     [](const std::vector<std::string> &, settings &s) {
+       s.opts.optimize_vertex_cache = false;
+       return true;
+     }},
+    {"anim-only", 0,
+     [](const std::vector<std::string> &, settings &s) {
+       s.opts.animations_only = true;
+       return true;
+     }},
+    {"skeleton", 1,
+     [](const std::vector<std::string> &args, settings &s) {
+       s.opts.skeleton_path = args[0];
+       return true;
+     }},
+    {"mmap", 0,
+     [](const std::vector<std::string> &, settings &s) {
+       s.opts.mmap_input = true;
+       return true;
+     }},
+    {"no-mmap", 0,
+     [](const std::vector<std::string> &, settings &s) {
+       s.opts.mmap_input = false;
+       return true;
+     }},
+    {"merge", 0,
+     [](const std::vector<std::string> &, settings &s) {
+       s.opts.merge_meshes = true;
+       return true;
+     }},
+    {"no-merge", 0,
+     [](const std::vector<std::string> &, settings &s) {
+       s.opts.merge_meshes = false;
+       return true;
+     }},
+    {"joint-bounds-weight", 1,
+     [](const std::vector<std::string> &args, settings &s) {
+       return parse_float(args[0], s.opts.joint_bounds_min_weight);
+     }},
+    {"meshlets", 0,
+     [](const std::vector<std::string> &, settings &s) {
+       s.opts.build_meshlets = true;
+       return true;
+     }},
+    {"meshlet-size", 2,
+     [](const std::vector<std::string> &args, settings &s) {
+       s.opts.build_meshlets = true;
+       return parse_size(args[0], s.opts.max_meshlet_vertices) &&
+              parse_size(args[1], s.opts.max_meshlet_triangles);
+     }},
+    {"palette-size", 1,
+     [](const std::vector<std::string> &args, settings &s) {
+       return parse_size(args[0], s.opts.max_palette_size);
+     }},
+    {"quantize", 0,
+     [](const std::vector<std::string> &, settings &s) {
+       s.opts.quantize = true;
+       return true;
+     }},
+    {"no-quantize", 0,
+     [](const std::vector<std::string> &, settings &s) {
+       s.opts.quantize = false;
+       return true;
+     }},
+    {"stream", 0,
+     [](const std::vector<std::string> &, settings &s) {
+       s.opts.stream_meshes = true;
+       return true;
+     }},
+    {"stats", 1,
+     [](const std::vector<std::string> &args, settings &s) {
+       s.opts.stats_file = args[0];
+       return true;
+     }},
+    {"log-level", 1,
+     [](const std::vector<std::string> &args, settings &) {
+       log_level level;
+       if (!parse_log_level(args[0], level)) {
+         return false;
+       }
+       set_log_level(level);
+       return true;
+     }},
+    {"verbose", 0,
+     [](const std::vector<std::string> &, settings &) {
+       set_log_level(log_level::kInfo);
+       return true;
+     }},
+    {"lods", 1,
+     [](const std::vector<std::string> &args, settings &s) {
+       return parse_floats(args[0], s.lod_ratios);
+     }},
+    {"lod-errors", 1,
+     [](const std::vector<std::string> &args, settings &s) {
+       return parse_floats(args[0], s.lod_errors);
+     }},
+    {"lod-max-error", 1,
+     [](const std::vector<std::string> &args, settings &s) {
+       return parse_float(args[0], s.lod_max_error);
+     }},
+    {"lod-skin-delta", 1,
+     [](const std::vector<std::string> &args, settings &s) {
+       return parse_float(args[0], s.opts.lod_max_skin_delta);
+     }},
+    {"optimize-anims", 0,
+     [](const std::vector<std::string> &, settings &s) {
+       s.opts.optimize_animations = true;
+       return true;
+     }},
+    {"no-optimize-anims", 0,
+     [](const std::vector<std::string> &, settings &s) {
+       s.opts.optimize_animations = false;
+       return true;
+     }},
+    {"anim-tolerance", 2,
+     [](const std::vector<std::string> &args, settings &s) {
+       s.opts.optimize_animations = true;
+       return parse_float(args[0], s.opts.anim_tolerance.tolerance) &&
+              parse_float(args[1], s.opts.anim_tolerance.distance);
+     }},
+    {"anim-joint-tolerance", 3,
+     [](const std::vector<std::string> &args, settings &s) {
+       s.opts.optimize_animations = true;
+       loader::animation_tolerance &tolerance =
+           s.opts.joint_tolerances[args[0]];
+       return parse_float(args[1], tolerance.tolerance) &&
+              parse_float(args[2], tolerance.distance);
+     }},
+    {"anim-tolerances", 1,
+     [](const std::vector<std::string> &args, settings &s) {
+       s.opts.optimize_animations = true;
+       return read_animation_tolerances(args[0], s.opts);
+     }},
+    {"bake-skinning", 1,
+     [](const std::vector<std::string> &args, settings &s) {
+       return parse_float(args[0], s.opts.bake_frame_rate);
+     }},
+    {"bake-half", 0,
+     [](const std::vector<std::string> &, settings &s) {
+       s.opts.bake_half = true;
+       return true;
+     }},
+    {"cache", 1,
+     [](const std::vector<std::string> &args, settings &s) {
+       s.opts.cache_dir = args[0];
+       return true;
+     }},
+    {"batch", 1,
+     [](const std::vector<std::string> &args, settings &s) {
+       s.batch_source = args[0];
+       return true;
+     }},
+    {"config", 1,
+     [](const std::vector<std::string> &args, settings &s) {
+       return read_config_file(args[0], s);
+     }},
+    {"preset", 1,
+     [](const std::vector<std::string> &args, settings &s) {
+       return apply_preset(args[0], s);
+     }},
+    {"flags", 1,
+     [](const std::vector<std::string> &args, settings &s) {
+       return parse_import_flags(args[0], s.opts.import_flags);
+     }},
+    {"property", 2,
+     [](const std::vector<std::string> &args, settings &s) {
+       return set_property(args[0], args[1], s.opts);
+     }},
+};
+
+const setting *find_setting(const std::string &name) {
+  for (const setting &candidate : all_settings) {
+    if (name == candidate.name) {
+      return &candidate;
+    }
+  }
+  return nullptr;
+}
+
+} // namespace
+
+bool apply_setting(const std::string &name,
+                   const std::vector<std::string> &args, settings &s) {
+  const setting *found = find_setting(name);
+  if (!found) {
+    LOG(ERROR) << "Unknown setting " << name;
+    return false;
+  }
+  if (args.size() != found->arg_count) {
+    LOG(ERROR) << "Setting " << name << " takes " << found->arg_count
+               << " arguments, got " << args.size();
+    return false;
+  }
+  if (!found->apply(args, s)) {
+    std::string joined;
+    for (const std::string &arg : args) {
+      joined += " " + arg;
+    }
+    LOG(ERROR) << "Invalid setting " << name << joined;
+    return false;
+  }
+  return true;
+}
+
+bool apply_preset(const std::string &name, settings &s) {
+  // Every loader stage goes back to its default, so that a preset gives the
+  // same result wherever it appears. What to convert and how to run keep
+  // their values.
+  loader::options opts;
+  opts.animations_only = s.opts.animations_only;
+  opts.skeleton_path = s.opts.skeleton_path;
+  opts.mmap_input = s.opts.mmap_input;
+  opts.jobs = s.opts.jobs;
+  opts.stream_meshes = s.opts.stream_meshes;
+  opts.stats_file = s.opts.stats_file;
+  opts.cache_dir = s.opts.cache_dir;
+  s.opts = opts;
+  s.lod_ratios.clear();
+  s.lod_errors.clear();
+  s.lod_max_error = 1.0f;
+
+  if (name == "default") {
+    return true;
+  }
+  if (name == "fast-iterate") {
+    // JoinIdenticalVertices and FindDegenerates dominate import time and do
+    // nothing on sources that are already indexed and clean.
+    s.opts.import_flags = aiProcess_Triangulate;
+    s.opts.optimize_vertex_cache = false;
+    return true;
+  }
+  if (name == "shipping-optimize") {
+    s.opts.import_flags |= aiProcess_LimitBoneWeights;
+    s.opts.importer_int_properties[AI_CONFIG_PP_LBW_MAX_WEIGHTS] = 4;
+    s.opts.optimize_animations = true;
+    s.opts.format = loader::output_format::OZZMESH;
+    s.opts.quantize = true;
+    s.opts.merge_meshes = true;
+    s.lod_ratios = {0.5f, 0.25f};
+    s.lod_max_error = 0.01f;
+    return true;
+  }
+  LOG(ERROR) << "Unknown preset " << name
+             << ", expected default, fast-iterate or shipping-optimize";
+  return false;
+}
+
+bool read_config_file(const std::string &filename, settings &s) {
+  std::ifstream file(filename);
+  if (!file) {
+    LOG(ERROR) << "Could not open config file " << filename;
+    return false;
+  }
+  std::string line;
+  size_t line_number = 0;
+  while (std::getline(file, line)) {
+    line_number++;
+    std::istringstream in(line);
+    std::string name;
+    if (!(in >> name) || name[0] == '#') {
+      continue;
+    }
+    if (name == "config") {
+      LOG(ERROR) << filename << ":" << line_number
+                 << ": config files cannot include other config files";
+      return false;
+    }
+    std::vector<std::string> args;
+    std::string arg;
+    while (in >> arg) {
+      args.push_back(arg);
+    }
+    if (!apply_setting(name, args, s)) {
+      LOG(ERROR) << "In " << filename << ":" << line_number;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool parse_command_line(int argc, char **argv, settings &s) {
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "-v") {
+      set_log_level(log_level::kInfo);
+    } else if (arg.compare(0, 2, "--") == 0) {
+      const std::string name = arg.substr(2);
+      const setting *found = find_setting(name);
+      if (!found) {
+        LOG(ERROR) << "Unknown option " << arg;
+        return false;
+      }
+      if (static_cast<size_t>(i) + found->arg_count >=
+          static_cast<size_t>(argc)) {
+        LOG(ERROR) << "Missing arguments to " << arg;
+        return false;
+      }
+      std::vector<std::string> args(argv + i + 1,
+                                    argv + i + 1 + found->arg_count);
+      i += static_cast<int>(found->arg_count);
+      if (!apply_setting(name, args, s)) {
+        return false;
+      }
+    } else if (s.filename.empty() && arg[0] != '-') {
+      s.filename = arg;
+    } else {
+      LOG(ERROR) << "Unexpected argument " << arg;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool finish_settings(settings &s) {
+  s.opts.lods.clear();
+  for (float ratio : s.lod_ratios) {
+    loader::lod_level level;
+    level.ratio = ratio;
+    level.max_error = s.lod_max_error;
+    s.opts.lods.push_back(level);
+  }
+  for (float error : s.lod_errors) {
+    loader::lod_level level;
+    level.max_error = error;
+    s.opts.lods.push_back(level);
+  }
+
+  if (s.opts.quantize && s.opts.format != loader::output_format::OZZMESH) {
+    LOG(ERROR) << "quantize is only supported with format ozzmesh, add "
+                  "--no-quantize to write another format";
+    return false;
+  }
+  // Streaming only bounds memory when meshes can be written as they are
+  // finished.
+  if (s.opts.stream_meshes && s.opts.merge_meshes) {
+    LOG(WARNING) << "stream has no effect with merge, which needs every mesh "
+                    "of a scene";
+  } else if (s.opts.stream_meshes &&
+             s.opts.format == loader::output_format::CAPNP) {
+    LOG(WARNING) << "stream has no effect with format capnp, which holds "
+                    "every mesh until the model file is written";
+  }
+  if (s.opts.animations_only && s.opts.skeleton_path.empty()) {
+    LOG(ERROR) << "anim-only needs --skeleton <runtime-skeleton.ozz>";
+    return false;
+  }
+  if (s.filename.empty() == s.batch_source.empty()) {
+    LOG(ERROR) << "Expected either a file or --batch";
+    return false;
+  }
+  return true;
+}
+
+bool parse_import_flags(const std::string &list, unsigned int &flags) {
+  std::istringstream in(list);
+  std::string item;
+  bool replaced = false;
+  while (std::getline(in, item, ',')) {
+    const char op = item.empty() ? '\0' : item[0];
+    const std::string name = op == '+' || op == '-' ? item.substr(1) : item;
+    const named_flag *found = nullptr;
+    for (const named_flag &step : import_steps) {
+      if (name == step.name) {
+        found = &step;
+      }
+    }
+    if (!found) {
+      LOG(ERROR) << "Unknown post-process step " << name;
+      return false;
+    }
+    if (op == '-') {
+      flags &= ~found->flag;
+    } else {
+      if (op != '+' && !replaced) {
+        flags = 0;
+        replaced = true;
+      }
+      flags |= found->flag;
+    }
+  }
+  return true;
+}
+
+void print_usage() {
+  std::cout
+      << "Usage: mesh_importer [options] <filename>\n"
+         "       mesh_importer [options] --batch <directory|manifest>\n"
+         "Options, also accepted one per line without the dashes by "
+         "--config:\n"
+         "  --config <file>                          read settings from a "
+         "file\n"
+         "  --preset <name>                          default, fast-iterate "
+         "or shipping-optimize\n"
+         "  --format json|capnp|ozzmesh              model file format\n"
+         "  --jobs <N>                               threads, one per core "
+         "by default\n"
+         "  --cache <dir>                            conversion cache\n"
+         "  --no-vertex-cache, --vertex-cache        keep the index and "
+         "vertex order of the source, or not\n"
+         "  --anim-only --skeleton <file>            convert animations "
+         "only, against a runtime-skeleton.ozz\n"
+         "  --no-mmap, --mmap                        read input files "
+         "with stdio instead of memory mappings, or not\n"
+         "  --merge, --no-merge                      merge meshes "
+         "sharing a material into one buffer set with draw ranges, or not\n"
+         "  --joint-bounds-weight <w>                leave vertices "
+         "weighted below w out of joint boxes (0.1)\n"
+         "  --meshlets                               cut meshes into "
+         "meshlets with culling bounds\n"
+         "  --meshlet-size <vertices> <triangles>    meshlet limits, "
+         "64 124 by default\n"
+         "  --palette-size <N>                       split skinned meshes "
+         "into submeshes using at most N joints\n"
+         "  --quantize, --no-quantize                compact vertex "
+         "streams, with --format ozzmesh, or not\n"
+         "  --stream                                 write meshes as they "
+         "are finished, bounding memory\n"
+         "  --stats <file>                           write timings, "
+         "allocations and counts per stage, mesh and animation\n"
+         "  --log-level error|warning|info|debug     messages to print "
+         "(warning), -v for info\n"
+         "Import pipeline:\n"
+         "  --flags <Step,...|+Step,-Step,...>       set or adjust Assimp "
+         "post-process steps (aiProcess_<Step>)\n"
+         "  --property <name> <value>                Assimp importer "
+         "property, ie AI_CONFIG_PP_LBW_MAX_WEIGHTS 4\n"
+         "Levels of detail:\n"
+         "  --lods <ratio,...>                       LODs keeping these "
+         "ratios of the triangles\n"
+         "  --lod-errors <error,...>                 LODs reaching these "
+         "errors, relative to the mesh size\n"
+         "  --lod-max-error <error>                  error cap of the "
+         "--lods levels\n"
+         "  --lod-skin-delta <delta>                 skinning difference "
+         "allowed to collapse vertices (0.25)\n"
+         "Animation optimization:\n"
+         "  --optimize-anims, --no-optimize-anims    reduce keys with "
+         "ozz's AnimationOptimizer, or not\n"
+         "  --anim-tolerance <tolerance> <distance>  default error, in "
+         "meters at distance from the joint\n"
+         "  --anim-joint-tolerance <joint> <tolerance> <distance>\n"
+         "  --anim-tolerances <file>                 read the above from a "
+         "file\n"
+         "Crowds:\n"
+         "  --bake-skinning <fps>                    bake skinning matrices "
+         "of every animation into .skinbake textures\n"
+         "  --bake-half                              store them as half "
+         "floats"
+      << std::endl;
+}
@@ -0,0 +1,54 @@
+// Conversion settings from presets, config files and the command line.
+// A setting has the same name everywhere: `--lods 0.5,0.25` on the command
+// line is `lods 0.5,0.25` in a config file. Settings apply in order, so
+// later ones override earlier ones, ie options after `--config <file>`
+// override the file and the file overrides the preset it names first.
+
+#pragma once
+
+#include "loader.hpp"
+
+struct settings {
+  loader::options opts;
+  // LOD levels are only built once every setting is read, so that
+  // lod-max-error applies wherever it appears.
+  std::vector<float> lod_ratios, lod_errors;
+  float lod_max_error = 1.0f;
+  std::string filename;
+  std::string batch_source;
+};
+
+// Applies one setting to `s`. Unknown names, wrong argument counts and bad
+// values are reported and return false.
+bool apply_setting(const std::string &name,
+                   const std::vector<std::string> &args, settings &s);
+
+// Resets the loader stages and import pipeline to a named preset:
+//   default            the post-process steps and stages of a plain run
+//   fast-iterate       triangulation only, no vertex cache, LODs or
+//                      animation optimization; for clean, already indexed
+//                      sources
+//   shipping-optimize  every cleanup step, at most 4 weights per vertex,
+//                      two LODs, optimized animations, meshes merged by
+//                      material and quantized .ozzmesh output
+// Every loader stage option is reset. The inputs, IO, logging, jobs,
+// streaming and caching are left alone.
+bool apply_preset(const std::string &name, settings &s);
+
+// One setting per line, its arguments separated by spaces. Empty lines and
+// lines starting with '#' are ignored.
+bool read_config_file(const std::string &filename, settings &s);
+
+// Settings are `--<name> <args>`, plus `-v` for `--verbose` and the file to
+// convert.
+bool parse_command_line(int argc, char **argv, settings &s);
+
+// Builds opts.lods and checks that the settings go together.
+bool finish_settings(settings &s);
+
+// Parses a post-process step list: "Triangulate,SortByPType" replaces the
+// steps, "+GenSmoothNormals,-FindDegenerates" adjusts them. Step names are
+// those of aiProcess_* without the prefix.
+bool parse_import_flags(const std::string &list, unsigned int &flags);
+
+void print_usage();
@@ -0,0 +1,210 @@
+#include "conversion_cache.hpp"
+
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace {
+
+// 64 bit FNV-1a.
+struct fnv1a {
+  uint64_t hash = 14695981039346656037ull;
+
+  void add(const void *data, size_t size) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; ++i) {
+      hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+  }
+};
+
+// Adds the bytes of the file at `path` to `hash`, and its size to `size`.
+bool hash_file(const std::string &path, fnv1a &hash, uint64_t &size) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  std::vector<char> buffer(1 << 20);
+  while (file) {
+    file.read(buffer.data(), buffer.size());
+    const size_t read = static_cast<size_t>(file.gcount());
+    hash.add(buffer.data(), read);
+    size += read;
+  }
+  return !file.bad();
+}
+
+// Lists the dependencies of an entry, one "<fingerprint> <path>" per line.
+// The leading dot keeps it apart from the outputs, which restore copies.
+const char *const kDependencies = ".dependencies";
+// Lists the output file names of an entry, one per line, so that restore
+// can tell a complete copy from one cut short by a concurrent store.
+const char *const kOutputs = ".outputs";
+
+// Identifies the content of the file at `path`, or its absence.
+std::string fingerprint(const std::string &path) {
+  fnv1a hash;
+  uint64_t size = 0;
+  if (!hash_file(path, hash, size)) {
+    return "missing";
+  }
+  std::ostringstream out;
+  out << std::hex << std::setfill('0') << std::setw(16) << hash.hash
+      << std::setw(16) << size;
+  return out.str();
+}
+
+// Whether every dependency recorded in `entry` still has the content it had
+// when the entry was stored. Entries without a list are stale.
+bool dependencies_unchanged(const boost::filesystem::path &entry) {
+  std::ifstream file((entry / kDependencies).string());
+  if (!file) {
+    return false;
+  }
+  std::string recorded, path;
+  while (file >> recorded && file.get() == ' ' && std::getline(file, path)) {
+    if (fingerprint(path) != recorded) {
+      return false;
+    }
+  }
+  return file.eof();
+}
+
+} // namespace
+
+bool conversion_cache::make_key(const std::string &input,
+                                unsigned int import_flags,
+                                const loader::options &opts,
+                                std::string &key) {
+  fnv1a content;
+  uint64_t size = 0;
+  if (!hash_file(input, content, size)) {
+    return false;
+  }
+  // Animations converted alone depend on the skeleton they are mapped to.
+  if (opts.animations_only &&
+      !hash_file(opts.skeleton_path, content, size)) {
+    return false;
+  }
+
+  // The location is part of the key: identical files in two directories
+  // can read different sidecar files.
+  boost::system::error_code ec;
+  const boost::filesystem::path location =
+      boost::filesystem::canonical(input, ec);
+  if (ec) {
+    return false;
+  }
+  std::ostringstream settings;
+  settings << MESH_IMPORTER_VERSION << ' ' << import_flags << ' '
+           << location.string() << ' ';
+  {
+    cereal::JSONOutputArchive archive(
+        settings, cereal::JSONOutputArchive::Options::NoIndent());
+    archive(cereal::make_nvp("options", opts));
+  }
+  fnv1a meta;
+  const std::string s = settings.str();
+  meta.add(s.data(), s.size());
+
+  // The size is part of the key to make content collisions even less likely.
+  std::ostringstream out;
+  out << std::hex << std::setfill('0') << std::setw(16) << content.hash
+      << std::setw(16) << size << std::setw(16) << meta.hash;
+  key = out.str();
+  return true;
+}
+
+bool conversion_cache::restore(const std::string &key,
+                               const std::string &output_dir) const {
+  namespace fs = boost::filesystem;
+  boost::system::error_code ec;
+  const fs::path entry = fs::path(root) / key;
+  if (!fs::is_directory(entry, ec) || !dependencies_unchanged(entry)) {
+    return false;
+  }
+  std::ifstream list((entry / kOutputs).string());
+  std::vector<std::string> names;
+  std::string name;
+  while (std::getline(list, name)) {
+    names.push_back(name);
+  }
+  if (names.empty() || !list.eof()) {
+    return false;
+  }
+
+  // A concurrent store can replace the entry while it is copied, so every
+  // output is first copied next to its destination. Only once all of them
+  // are there are they renamed into place.
+  const fs::path staging =
+      fs::path(output_dir) / fs::unique_path(".restore-%%%%-%%%%-%%%%");
+  fs::create_directories(staging, ec);
+  for (const std::string &n : names) {
+    if (ec) {
+      break;
+    }
+    fs::copy_file(entry / n, staging / n,
+                  fs::copy_option::overwrite_if_exists, ec);
+  }
+  for (const std::string &n : names) {
+    if (ec) {
+      break;
+    }
+    fs::rename(staging / n, fs::path(output_dir) / n, ec);
+  }
+  boost::system::error_code ignored;
+  fs::remove_all(staging, ignored);
+  return !ec;
+}
+
+bool conversion_cache::store(
+    const std::string &key, const std::vector<std::string> &files,
+    const std::vector<std::string> &dependencies) const {
+  namespace fs = boost::filesystem;
+  boost::system::error_code ec;
+  const fs::path entry = fs::path(root) / key;
+  if (fs::is_directory(entry, ec) && dependencies_unchanged(entry)) {
+    return true;
+  }
+  const fs::path staging =
+      fs::path(root) / fs::unique_path(key + ".tmp-%%%%-%%%%-%%%%");
+  fs::create_directories(staging, ec);
+  for (const std::string &f : files) {
+    if (ec) {
+      break;
+    }
+    fs::copy_file(f, staging / fs::path(f).filename(),
+                  fs::copy_option::overwrite_if_exists, ec);
+  }
+  bool listed = false;
+  if (!ec) {
+    std::ofstream list((staging / kDependencies).string());
+    for (const std::string &d : dependencies) {
+      list << fingerprint(d) << ' ' << d << '\n';
+    }
+    std::ofstream outputs((staging / kOutputs).string());
+    for (const std::string &f : files) {
+      outputs << fs::path(f).filename().string() << '\n';
+    }
+    listed = list.flush().good() && outputs.flush().good();
+  }
+  boost::system::error_code ignored;
+  if (listed && fs::is_directory(entry, ignored)) {
+    // Stale. Moved aside first, since a rename cannot replace a directory
+    // that is not empty; another converter may have done so already.
+    const fs::path stale =
+        fs::path(root) / fs::unique_path(key + ".stale-%%%%-%%%%-%%%%");
+    fs::rename(entry, stale, ignored);
+    fs::remove_all(stale, ignored);
+  }
+  if (listed) {
+    fs::rename(staging, entry, ec);
+  }
+  if (!listed || ec) {
+    // Either a copy failed or another converter published the same entry
+    // first; the staging copy is not needed in both cases.
+    fs::remove_all(staging, ignored);
+    return fs::is_directory(entry, ignored);
+  }
+  return true;
+}
@@ -0,0 +1,40 @@
+// Content-addressed cache of conversion outputs. An entry is keyed on the
+// bytes and location of the input file, the Assimp post-process flags, the
+// tool version and the loader options. Each entry also records the content
+// of the other files the importer read (glTF buffers, OBJ materials...),
+// which must be unchanged for a hit. A hit means the outputs would be identical and the
+// scene does not need to be loaded at all.
+
+#pragma once
+
+#include "loader.hpp"
+
+#ifndef MESH_IMPORTER_VERSION
+#define MESH_IMPORTER_VERSION "dev"
+#endif
+
+class conversion_cache {
+public:
+  explicit conversion_cache(const std::string &root) : root(root) {}
+
+  // Hashes everything the outputs of `input` depend on, including the
+  // skeleton when converting animations only. Returns false if either
+  // cannot be read.
+  static bool make_key(const std::string &input, unsigned int import_flags,
+                       const loader::options &opts, std::string &key);
+
+  // Copies the outputs stored under `key` into output_dir. Returns false on
+  // a miss, including when a dependency of the entry has changed or when
+  // the entry was replaced before all of its outputs were copied.
+  bool restore(const std::string &key, const std::string &output_dir) const;
+
+  // Stores `files` under `key`, along with the content of `dependencies`,
+  // the files the importer read. Entries are published with a rename, so
+  // concurrent converters of the same input never see a partial entry. An
+  // entry whose dependencies changed is replaced.
+  bool store(const std::string &key, const std::vector<std::string> &files,
+             const std::vector<std::string> &dependencies) const;
+
+protected:
+  std::string root;
+};
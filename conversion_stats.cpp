@@ -0,0 +1,43 @@
+#include "conversion_stats.hpp"
+#include "conversion_cache.hpp"
+#include "log.hpp"
+
+#include <boost/filesystem.hpp>
+#include <cereal/archives/json.hpp>
+#include <fstream>
+
+namespace {
+
+struct stats_report {
+  std::string version = MESH_IMPORTER_VERSION;
+  std::vector<conversion_stats> files;
+
+  template <class Archive> void serialize(Archive &archive) {
+    archive(CEREAL_NVP(version), CEREAL_NVP(files));
+  }
+};
+
+} // namespace
+
+bool write_stats_report(const std::string &filename,
+                        const std::vector<conversion_stats> &files) {
+  const boost::filesystem::path parent =
+      boost::filesystem::path(filename).parent_path();
+  if (!parent.empty()) {
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(parent, ec);
+  }
+  std::ofstream file(filename);
+  if (!file) {
+    LOG(ERROR) << "Could not write " << filename;
+    return false;
+  }
+  stats_report report;
+  report.files = files;
+  {
+    cereal::JSONOutputArchive archive(file);
+    archive(cereal::make_nvp("stats", report));
+  }
+  LOG(INFO) << "Stats written to " << filename;
+  return true;
+}
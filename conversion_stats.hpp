@@ -0,0 +1,92 @@
+// Per-file report of a conversion, written as JSON by --stats: stage
+// timings plus element counts of every mesh and animation, to find the
+// assets that are slow or large in a big batch.
+
+#pragma once
+
+#include "stage_timings.hpp"
+
+#include <cereal/types/vector.hpp>
+#include <string>
+#include <vector>
+
+struct mesh_stats {
+  std::string name;
+  // Source counts, then what was written (after palettes duplicated
+  // vertices, if enabled).
+  size_t source_vertices = 0;
+  size_t source_faces = 0;
+  size_t vertices = 0;
+  size_t triangles = 0;
+  size_t bones = 0;
+  size_t lods = 0;
+  size_t submeshes = 0;
+  size_t meshlets = 0;
+  // Extraction, vertex cache and LODs, on the thread processing the mesh.
+  double seconds = 0.0;
+  size_t allocations = 0;
+  size_t allocated_bytes = 0;
+  // Bytes of the model file written for this mesh. Cap'n Proto writes the
+  // whole message at the end, so its meshes report 0.
+  size_t bytes_written = 0;
+
+  template <class Archive> void serialize(Archive &archive) {
+    archive(CEREAL_NVP(name), CEREAL_NVP(source_vertices),
+            CEREAL_NVP(source_faces), CEREAL_NVP(vertices),
+            CEREAL_NVP(triangles), CEREAL_NVP(bones), CEREAL_NVP(lods),
+            CEREAL_NVP(submeshes), CEREAL_NVP(meshlets), CEREAL_NVP(seconds),
+            CEREAL_NVP(allocations), CEREAL_NVP(allocated_bytes),
+            CEREAL_NVP(bytes_written));
+  }
+};
+
+struct animation_stats {
+  std::string name;
+  size_t channels = 0; // Source channels, including those of non-joints.
+  size_t unmapped_channels = 0; // Channels matching no joint, skipped.
+  size_t tracks = 0;   // Joints of the skeleton.
+  size_t keys_in = 0;
+  size_t keys_out = 0; // After optimization, if enabled.
+  size_t runtime_bytes = 0;
+  // Raw and runtime archives.
+  size_t bytes_written = 0;
+  double seconds = 0.0;
+  size_t allocations = 0;
+  size_t allocated_bytes = 0;
+
+  template <class Archive> void serialize(Archive &archive) {
+    archive(CEREAL_NVP(name), CEREAL_NVP(channels),
+            CEREAL_NVP(unmapped_channels), CEREAL_NVP(tracks),
+            CEREAL_NVP(keys_in), CEREAL_NVP(keys_out),
+            CEREAL_NVP(runtime_bytes), CEREAL_NVP(bytes_written),
+            CEREAL_NVP(seconds), CEREAL_NVP(allocations),
+            CEREAL_NVP(allocated_bytes));
+  }
+};
+
+struct conversion_stats {
+  std::string file;
+  bool success = false;
+  // Outputs were restored from the conversion cache, so there is nothing
+  // but the time.
+  bool cached = false;
+  double seconds = 0.0; // Whole conversion, import included.
+  // Process wide, so it covers concurrent conversions of a batch too.
+  size_t peak_rss_bytes = 0;
+  size_t joints = 0;
+  size_t bytes_written = 0; // Every output file.
+  std::vector<stage_timing> stages;
+  std::vector<mesh_stats> meshes;
+  std::vector<animation_stats> animations;
+
+  template <class Archive> void serialize(Archive &archive) {
+    archive(CEREAL_NVP(file), CEREAL_NVP(success), CEREAL_NVP(cached),
+            CEREAL_NVP(seconds), CEREAL_NVP(peak_rss_bytes),
+            CEREAL_NVP(joints), CEREAL_NVP(bytes_written), CEREAL_NVP(stages),
+            CEREAL_NVP(meshes), CEREAL_NVP(animations));
+  }
+};
+
+// Writes `files` to `filename` as {"stats": {"version", "files"}}.
+bool write_stats_report(const std::string &filename,
+                        const std::vector<conversion_stats> &files);
@@ -1,4 +1,19 @@
 #include "loader.hpp"
+#include "animation_optimize.hpp"
+#include "async_writer.hpp"
+#include "bounds.hpp"
+#include "lod.hpp"
+#include "log.hpp"
+#include "memory_stats.hpp"
+#include "mesh_merge.hpp"
+#include "meshlet.hpp"
+#include "mmap_io_system.hpp"
+#include "model_writer.hpp"
+#include "output_sink.hpp"
+#include "palette.hpp"
+#include "parallel.hpp"
+#include "skinning_baker.hpp"
+#include "vertex_cache.hpp"
 
 #include <ozz/animation/offline/animation_builder.h>
 #include <ozz/animation/offline/raw_animation.h>
@@ -6,290 +21,655 @@
 #include <ozz/animation/runtime/animation.h>
 #include <ozz/animation/runtime/skeleton.h>
 
-#include <fstream>
-#include <iostream>
+#include <algorithm>
+#include <cmath>
 #include <memory>
+#include <sstream>
 
-void loader::hierarchy::init(const aiScene *scene,
-                             const std::set<std::string> &bone_names) {
-  for (std::string s : bone_names) {
-    aiNode *ai_node = scene->mRootNode->FindNode(s.c_str());
-    lemon::ListDigraph::Node lemon_node = add(ai_node);
-    nodes.insert(std::make_pair(ai_node, lemon_node));
-  }
+namespace {
 
-  recursive_build(scene->mRootNode, bone_names);
+// aiMatrix4x4 is row-major.
+std::array<float, 16> column_major(const aiMatrix4x4 &m) {
+  std::array<float, 16> out;
+  for (unsigned int c = 0; c < 4; ++c) {
+    for (unsigned int r = 0; r < 4; ++r) {
+      out[c * 4 + r] = m[r][c];
+    }
+  }
+  return out;
 }
 
-ozz::animation::offline::RawSkeleton loader::hierarchy::make_raw_skeleton() {
-  std::vector<lemon::ListDigraph::Node> roots = find_roots();
-
-  std::cout << "Skeleton roots: ";
-  for (lemon::ListDigraph::Node r : roots) {
-    std::cout << _name[r] << " ";
+// Largest difference between two matrices, relative to their magnitude so
+// that translations in centimeters compare like those in meters.
+float matrix_difference(const std::array<float, 16> &a,
+                        const std::array<float, 16> &b) {
+  float difference = 0.0f;
+  for (size_t i = 0; i < 16; ++i) {
+    const float scale =
+        std::max(1.0f, std::max(std::fabs(a[i]), std::fabs(b[i])));
+    difference = std::max(difference, std::fabs(a[i] - b[i]) / scale);
   }
-  std::cout << std::endl;
-
-  size_t num_roots = roots.size();
-  ozz::animation::offline::RawSkeleton raw_skeleton;
-  raw_skeleton.roots.resize(num_roots);
+  return difference;
+}
 
-  std::cout << "About to start building skeleton." << std::endl;
-  for (size_t i = 0; i < num_roots; i++) {
-    lemon::ListDigraph::Node r = roots[i];
-    ozz::animation::offline::RawSkeleton::Joint &root_joint =
-        raw_skeleton.roots[i];
-    // std::cout << "Starting recursive build from root " << _name[r] <<
-    // std::endl;
-    recursive_ozz_helper(r, root_joint, i);
+// Archives `object` as the output `name` of `sink`. Returns its size, 0 if
+// it could not be written.
+template <typename T>
+size_t write_archive(output_sink &sink, const std::string &name,
+                     const T &object) {
+  ozz::io::Stream *stream = sink.open(name);
+  if (!stream) {
+    return 0;
   }
-  return raw_skeleton;
+  {
+    ozz::io::OArchive archive(stream);
+    archive << object;
+  }
+  const size_t size = stream->Size();
+  return sink.close(stream) ? size : 0;
 }
 
-void loader::hierarchy::print_info() {
-  size_t count = 0;
+// Archives `object` into memory, for async_writer.
+template <typename T>
+std::unique_ptr<buffer_stream> archive_to_buffer(const T &object) {
+  std::unique_ptr<buffer_stream> buffer(new buffer_stream());
+  ozz::io::OArchive archive(buffer.get());
+  archive << object;
+  return buffer;
+}
 
-  for (lemon::ListDigraph::NodeIt it(_graph); it != lemon::INVALID; ++it) {
-    count++;
-    lemon::ListDigraph::Node n(it);
-    std::cout << "Node " << count << " name = " << _name[n] << std::endl;
+// Channels of a clip that match no joint are skipped. Clips exported
+// against another rig than the skeleton's show up here.
+void print_channel_report(const std::string &anim_name,
+                          const std::vector<std::string> &unmapped_channels,
+                          size_t joints_animated, size_t num_joints,
+                          bool warn) {
+  LOG(INFO) << "Animation " << anim_name << " animates " << joints_animated
+            << " of " << num_joints << " joints.";
+  if (unmapped_channels.empty()) {
+    return;
+  }
+  std::ostringstream message;
+  message << unmapped_channels.size() << " channels of animation "
+          << anim_name << " match no joint and are skipped:";
+  for (size_t i = 0; i < unmapped_channels.size(); ++i) {
+    message << (i == 0 ? " " : ", ") << unmapped_channels[i];
+  }
+  if (warn) {
+    LOG(WARNING) << message.str();
+  } else {
+    LOG(INFO) << message.str();
   }
-
-  std::cout << "Node Count = " << count << std::endl;
-
-  // recursive_print();
 }
 
-void loader::hierarchy::recursive_ozz_helper(
-    const lemon::ListDigraph::Node &n,
-    ozz::animation::offline::RawSkeleton::Joint &caller_joint, size_t index) {
-  size_t children_count = 0;
+// Bind poses exported by different meshes of the same rig usually agree to
+// float precision; larger differences mean the meshes were bound apart.
+const float kBindPoseTolerance = 1e-4f;
 
-  caller_joint.name = _name[n].c_str();
+} // namespace
 
-  caller_joint.transform.translation = ozz::math::Float3(
-      _translation[n][0], _translation[n][1], _translation[n][2]);
-  caller_joint.transform.rotation = ozz::math::Quaternion(
-      _rotation[n][0], _rotation[n][1], _rotation[n][2], _rotation[n][3]);
-  caller_joint.transform.scale =
-      ozz::math::Float3(_scale[n][0], _scale[n][1], _scale[n][2]);
+void loader::hierarchy::init(const aiScene *scene,
+                             const std::set<std::string> &bone_names) {
+  std::set<std::string> remaining = bone_names;
+  // Nodes still to visit, with the joint index of their closest joint
+  // parent node, or -1 when their parent node is not a joint.
+  std::vector<std::pair<const aiNode *, int>> stack;
+  stack.push_back(std::make_pair(scene->mRootNode, -1));
+  while (!stack.empty() && !remaining.empty()) {
+    const aiNode *node = stack.back().first;
+    const int parent = stack.back().second;
+    stack.pop_back();
+
+    int joint = -1;
+    auto it = remaining.find(std::string(node->mName.C_Str()));
+    if (it != remaining.end()) {
+      joint = static_cast<int>(_names.size());
+      aiVector3D scale, trans;
+      aiQuaternion rot;
+      node->mTransformation.Decompose(scale, rot, trans);
+      ozz::math::Transform transform;
+      transform.translation = ozz::math::Float3(trans.x, trans.y, trans.z);
+      transform.rotation = ozz::math::Quaternion(rot.x, rot.y, rot.z, rot.w);
+      transform.scale = ozz::math::Float3(scale.x, scale.y, scale.z);
+
+      _names.push_back(*it);
+      _parents.push_back(parent);
+      _transforms.push_back(transform);
+      remaining.erase(it);
+    }
+    // Reversed, so that children are visited in order.
+    for (size_t i = node->mNumChildren; i > 0; --i) {
+      stack.push_back(std::make_pair(node->mChildren[i - 1], joint));
+    }
+  }
+}
 
-  for (lemon::ListDigraph::OutArcIt it(_graph, n); it != lemon::INVALID; ++it) {
-    children_count++;
+ozz::animation::offline::RawSkeleton
+loader::hierarchy::make_raw_skeleton() const {
+  typedef ozz::animation::offline::RawSkeleton::Joint Joint;
+  const size_t num_joints = _names.size();
+
+  // Every children array is sized before anything points into it, so the
+  // pointers below stay valid.
+  std::vector<size_t> child_counts(num_joints, 0);
+  size_t num_roots = 0;
+  for (size_t i = 0; i < num_joints; ++i) {
+    if (_parents[i] < 0) {
+      num_roots++;
+    } else {
+      child_counts[_parents[i]]++;
+    }
   }
 
-  // std::cout << "Adding joint to skeleton. Name = " << _name[n]
-  //          << ", number of children = " << children_count << std::endl;
+  ozz::animation::offline::RawSkeleton raw_skeleton;
+  raw_skeleton.roots.resize(num_roots);
+  std::vector<Joint *> joints(num_joints);
+  std::vector<size_t> next_child(num_joints, 0);
+  size_t next_root = 0;
+
+  std::string root_names;
+  for (size_t i = 0; i < num_joints; ++i) {
+    const int parent = _parents[i];
+    Joint *joint;
+    if (parent < 0) {
+      joint = &raw_skeleton.roots[next_root++];
+      root_names += " " + _names[i];
+    } else {
+      joint = &joints[parent]->children[next_child[parent]++];
+    }
+    joint->name = _names[i].c_str();
+    joint->transform = _transforms[i];
+    joint->children.resize(child_counts[i]);
+    joints[i] = joint;
+  }
+  LOG(INFO) << "Skeleton roots:" << root_names;
+  return raw_skeleton;
+}
 
-  caller_joint.children.resize(children_count);
+void loader::hierarchy::print_info() const {
+  for (size_t i = 0; i < _names.size(); ++i) {
+    LOG(DEBUG) << "Node " << i + 1 << " name = " << _names[i];
+  }
+  LOG(INFO) << "Node Count = " << _names.size();
+}
 
-  size_t current_index = 0;
+void loader::extract_mesh(const aiMesh *mesh_data,
+                          loader::SerializedMesh &temp_mesh) {
+  temp_mesh.name = std::string(mesh_data->mName.C_Str());
+  size_t num_verts = mesh_data->mNumVertices;
+  size_t num_faces = mesh_data->mNumFaces;
+  size_t num_bones = mesh_data->mNumBones;
+  bool has_bones = mesh_data->HasBones();
+  bool has_normals = mesh_data->HasNormals();
+  bool has_texcoords = mesh_data->HasTextureCoords(0);
+
+  temp_mesh.positions.resize(num_verts);
+  if (has_normals) {
+    temp_mesh.normals.resize(num_verts);
+  }
+  if (has_texcoords) {
+    temp_mesh.uvs.resize(num_verts);
+  }
+  for (size_t n = 0; n < num_verts; ++n) {
+    aiVector3D pt = mesh_data->mVertices[n];
 
-  for (lemon::ListDigraph::OutArcIt it(_graph, n); it != lemon::INVALID; ++it) {
-    lemon::ListDigraph::Arc arc(it);
-    lemon::ListDigraph::Node next_node = _graph.target(it);
+    // mesh_vertex v;
+    temp_mesh.positions[n][0] = pt[0];
+    temp_mesh.positions[n][1] = pt[1];
+    temp_mesh.positions[n][2] = pt[2];
 
-    ozz::animation::offline::RawSkeleton::Joint &current_joint =
-        caller_joint.children[current_index];
-    recursive_ozz_helper(next_node, current_joint, current_index);
-    current_index++;
+    if (has_normals) {
+      aiVector3D normal = mesh_data->mNormals[n];
+      temp_mesh.normals[n][0] = normal[0];
+      temp_mesh.normals[n][1] = normal[1];
+      temp_mesh.normals[n][2] = normal[2];
+    }
+    if (has_texcoords) {
+      aiVector3D uv = mesh_data->mTextureCoords[0][n];
+      temp_mesh.uvs[n][0] = uv.x;
+      temp_mesh.uvs[n][1] = uv.y;
+    }
   }
-}
 
-std::vector<lemon::ListDigraph::Node> loader::hierarchy::find_roots() {
-  std::vector<lemon::ListDigraph::Node> roots;
-  for (lemon::ListDigraph::NodeIt it(_graph); it != lemon::INVALID; ++it) {
-    size_t count = 0;
-    lemon::ListDigraph::Node n(it);
+  temp_mesh.bounds = compute_bounds(temp_mesh.positions);
+  temp_mesh.dimensions = bounds_dimensions(temp_mesh.bounds);
+
+  temp_mesh.indices.reserve(num_faces * 3);
+  for (size_t face_id = 0; face_id < num_faces; ++face_id) {
+    aiFace face = mesh_data->mFaces[face_id];
+    if (face.mNumIndices == 3) {
+      temp_mesh.indices.push_back(face.mIndices[0]);
+      temp_mesh.indices.push_back(face.mIndices[1]);
+      temp_mesh.indices.push_back(face.mIndices[2]);
+    }
+    // else {
+    //   std::cout<< "Found faces with " << face.mNumIndices << " indicce" <<
+    //   std::endl;
+    // }
+  }
 
-    for (lemon::ListDigraph::InArcIt e(_graph, n); e != lemon::INVALID; ++e) {
-      ++count;
+  if (has_bones) {
+    // Bone indices are positions in temp_mesh.bone_names until load() maps
+    // them to skeleton joints.
+    temp_mesh.bone_indices.resize(num_verts);
+    temp_mesh.bone_weights.resize(num_verts);
+
+    for (size_t n = 0; n < num_bones; ++n) {
+      aiBone *bone_data = mesh_data->mBones[n];
+      temp_mesh.bone_names.push_back(std::string(bone_data->mName.C_Str()));
+      temp_mesh.inverse_bind_matrices.push_back(
+          column_major(bone_data->mOffsetMatrix));
+
+      // Keeps the 4 largest influences of each vertex.
+      for (uint32_t i = 0; i < bone_data->mNumWeights; ++i) {
+        const aiVertexWeight &weight = bone_data->mWeights[i];
+        std::array<float, 4> &weights =
+            temp_mesh.bone_weights[weight.mVertexId];
+        const size_t smallest =
+            std::min_element(weights.begin(), weights.end()) - weights.begin();
+        if (weight.mWeight > weights[smallest]) {
+          weights[smallest] = weight.mWeight;
+          temp_mesh.bone_indices[weight.mVertexId][smallest] =
+              static_cast<uint32_t>(n);
+        }
+      }
     }
 
-    if (count == 0) {
-      roots.push_back(n);
+    for (std::array<float, 4> &weights : temp_mesh.bone_weights) {
+      const float sum = weights[0] + weights[1] + weights[2] + weights[3];
+      if (sum > 0.0f) {
+        for (float &w : weights) {
+          w /= sum;
+        }
+      }
     }
   }
-  return roots;
+  temp_mesh.material_index = mesh_data->mMaterialIndex;
 }
 
-void loader::hierarchy::recursive_build(
-    aiNode *current, const std::set<std::string> &bone_names) {
-  std::string current_node_name = std::string(current->mName.C_Str());
-  for (size_t i = 0; i < current->mNumChildren; i++) {
-    aiNode *child = current->mChildren[i];
-
-    if (bone_names.find(current_node_name) != bone_names.end()) {
-      std::string child_name =
-          std::string(current->mChildren[i]->mName.C_Str());
+void loader::configure_importer(Assimp::Importer &importer,
+                                const loader::options &opts) {
+  for (const std::pair<const std::string, int> &p :
+       opts.importer_int_properties) {
+    importer.SetPropertyInteger(p.first.c_str(), p.second);
+  }
+  for (const std::pair<const std::string, float> &p :
+       opts.importer_float_properties) {
+    importer.SetPropertyFloat(p.first.c_str(), p.second);
+  }
+  // The importer owns its IO system; batch workers keep theirs across files.
+  mmap_io_system *io =
+      dynamic_cast<mmap_io_system *>(importer.GetIOHandler());
+  if (!io) {
+    io = new mmap_io_system();
+    importer.SetIOHandler(io);
+  }
+  io->set_map_files(opts.mmap_input);
+  // Only the files of the next scene are of interest.
+  io->take_accessed_files();
+}
 
-      if (bone_names.find(child_name) != bone_names.end()) {
-        //  std::cout << "Linking parent " << current_node_name << " and child "
-        //          << child_name << std::endl;
-        link(current, child);
+std::vector<std::array<float, 16>> loader::merge_inverse_bind_matrices(
+    const aiScene *scene,
+    const std::unordered_map<std::string, size_t> &joint_indices) {
+  std::array<float, 16> identity = {};
+  identity[0] = identity[5] = identity[10] = identity[15] = 1.0f;
+  // Every joint is named after a bone, so none keeps the identity.
+  std::vector<std::array<float, 16>> merged(joint_indices.size(), identity);
+  std::vector<const aiMesh *> bound_by(joint_indices.size(), nullptr);
+  for (size_t mesh_num = 0; mesh_num < scene->mNumMeshes; ++mesh_num) {
+    const aiMesh *mesh_data = scene->mMeshes[mesh_num];
+    for (size_t n = 0; n < mesh_data->mNumBones; ++n) {
+      const aiBone *bone_data = mesh_data->mBones[n];
+      auto it = joint_indices.find(std::string(bone_data->mName.C_Str()));
+      if (it == joint_indices.end()) {
+        continue;
+      }
+      const std::array<float, 16> m = column_major(bone_data->mOffsetMatrix);
+      const size_t joint = it->second;
+      if (!bound_by[joint]) {
+        merged[joint] = m;
+        bound_by[joint] = mesh_data;
+        continue;
+      }
+      const float difference = matrix_difference(merged[joint], m);
+      if (difference > kBindPoseTolerance) {
+        LOG(WARNING) << "Mesh " << mesh_data->mName.C_Str() << " binds "
+                     << it->first << " differently than mesh "
+                     << bound_by[joint]->mName.C_Str() << " (off by "
+                     << difference << "), keeping its own bind pose";
       }
     }
-    recursive_build(child, bone_names);
   }
+  return merged;
 }
 
-void loader::hierarchy::link(aiNode *parent, aiNode *child) {
-  lemon::ListDigraph::Node p = nodes.find(parent)->second;
-  lemon::ListDigraph::Node c = nodes.find(child)->second;
-  _graph.addArc(p, c);
-}
-
-lemon::ListDigraph::Node loader::hierarchy::add(aiNode *assimp_node) {
-  std::string name = std::string(assimp_node->mName.C_Str());
+bool loader::assign_joints(
+    loader::SerializedMesh &m,
+    const std::unordered_map<std::string, size_t> &joint_indices,
+    const std::vector<std::string> &joint_names,
+    const std::vector<std::array<float, 16>> &inverse_bind_matrices) const {
+  // Maps the bones of the mesh to skeleton joints, once per bone, and
+  // rewrites the vertex bone indices in place.
+  std::vector<uint32_t> bone_joints(m.bone_names.size());
+  for (size_t b = 0; b < m.bone_names.size(); ++b) {
+    auto it = joint_indices.find(m.bone_names[b]);
+    if (it == joint_indices.end()) {
+      LOG(ERROR) << "Could not find bone index for " << m.bone_names[b]
+                 << " in joint indices map!";
+      return false;
+    }
+    bone_joints[b] = static_cast<uint32_t>(it->second);
+  }
+  for (size_t v = 0; v < m.bone_indices.size(); ++v) {
+    for (size_t i = 0; i < 4; ++i) {
+      m.bone_indices[v][i] =
+          m.bone_weights[v][i] > 0.0f ? bone_joints[m.bone_indices[v][i]] : 0;
+    }
+  }
+  m.bone_names = joint_names;
+  // Joints the mesh does not bind take the scene's bind pose, so that every
+  // skinned mesh has a full table in joint order.
+  if (!m.bone_weights.empty()) {
+    std::vector<std::array<float, 16>> joint_matrices = inverse_bind_matrices;
+    for (size_t b = 0; b < bone_joints.size(); ++b) {
+      joint_matrices[bone_joints[b]] = m.inverse_bind_matrices[b];
+    }
+    m.inverse_bind_matrices = std::move(joint_matrices);
+    m.joint_bounds = compute_joint_bounds(m, opts.joint_bounds_min_weight);
+  }
 
-  aiMatrix4x4 mat = assimp_node->mTransformation;
-  aiVector3D scale, trans;
-  aiQuaternion rot;
+  if (opts.max_palette_size > 0) {
+    palette_report report;
+    if (!partition_palettes(m, opts.max_palette_size, report)) {
+      return false;
+    }
+    print_palette_report(report);
+  }
+  return true;
+}
 
-  mat.Decompose(scale, rot, trans);
+bool loader::convert_animation(
+    const aiAnimation *anim, size_t anim_num, size_t num_anims,
+    const std::unordered_map<std::string, size_t> &joint_indices,
+    const ozz::animation::Skeleton &skeleton,
+    const ozz::vector<ozz::math::Float4x4> &inverse_bind_matrices,
+    const std::vector<skinned_meshlet> &skinned_meshlets,
+    async_writer &writer, stage_timings &anim_timings,
+    animation_stats &anim_stats,
+    std::vector<meshlet_motion> &meshlet_motions) const {
+  const size_t num_joints = skeleton.num_joints();
+  double ticks = anim->mDuration;
+  double ticks_per_sec = anim->mTicksPerSecond;
+  size_t num_unfiltered_channels = anim->mNumChannels;
+
+  if (ticks_per_sec < 0.0001) {
+    ticks_per_sec = 1.0;
+  }
 
-  lemon::ListDigraph::Node graph_node = _graph.addNode();
+  std::string anim_name = std::string(anim->mName.C_Str());
+  LOG(INFO) << "Assimp animation " << anim_num + 1 << " out of "
+            << num_anims << ". Name: " << anim_name << ". Ticks = " << ticks
+            << ". Ticks per second = " << ticks_per_sec
+            << ". Number of (unfiltered) channels = "
+            << num_unfiltered_channels;
+
+  const stage_sample anim_sample;
+  anim_stats.name = anim_name;
+  anim_stats.channels = num_unfiltered_channels;
+  anim_stats.tracks = num_joints;
+
+  anim_timings.begin("animation_extract");
+  ozz::animation::offline::RawAnimation raw_animation;
+  // Assimp times are in ticks, ozz's in seconds.
+  raw_animation.duration = static_cast<float>(ticks / ticks_per_sec);
+
+  // Filter out the anim nodes that aren't bones.
+  // TODO: Find out whether this is necessary or desirable
+  std::set<std::tuple<size_t, aiNodeAnim *>> valid_channels;
+  std::vector<std::string> unmapped_channels;
+  for (size_t num = 0; num < num_unfiltered_channels; ++num) {
+    aiNodeAnim *anim_node = anim->mChannels[num];
+    std::string anim_node_name = std::string(anim_node->mNodeName.C_Str());
+    auto it = joint_indices.find(anim_node_name);
+    if (it != joint_indices.end()) {
+      size_t anim_node_skeleton_index = it->second;
+      valid_channels.insert(
+          std::make_tuple(anim_node_skeleton_index, anim_node));
+    } else {
+      unmapped_channels.push_back(anim_node_name);
+    }
+  }
+  std::set<size_t> animated_joints;
+  for (const std::tuple<size_t, aiNodeAnim *> &chan : valid_channels) {
+    animated_joints.insert(std::get<0>(chan));
+  }
+  anim_stats.unmapped_channels = unmapped_channels.size();
+  // Against a given skeleton, every channel is expected to match.
+  print_channel_report(anim_name, unmapped_channels, animated_joints.size(),
+                       num_joints, opts.animations_only);
+  if (opts.animations_only && valid_channels.empty() &&
+      num_unfiltered_channels > 0) {
+    LOG(ERROR) << "No channel of animation " << anim_name
+               << " matches a joint of the skeleton!";
+    return false;
+  }
 
-  _translation[graph_node] = {trans.x, trans.y, trans.z};
-  _scale[graph_node] = {scale.x, scale.y, scale.z};
-  _rotation[graph_node] = {rot.x, rot.y, rot.z, rot.w};
-  _name[graph_node] = name;
+  raw_animation.tracks.resize(num_joints);
+  for (std::tuple<size_t, aiNodeAnim *> chan : valid_channels) {
+    size_t track_index = std::get<0>(chan);
+    aiNodeAnim *anim_node = std::get<1>(chan);
+
+    size_t num_translations = anim_node->mNumPositionKeys;
+    size_t num_rotations = anim_node->mNumRotationKeys;
+    size_t num_scales = anim_node->mNumScalingKeys;
+
+    for (size_t i = 0; i < num_translations; ++i) {
+      aiVectorKey k = anim_node->mPositionKeys[i];
+      double t = k.mTime / ticks_per_sec;
+      aiVector3D val = k.mValue;
+      const ozz::animation::offline::RawAnimation::TranslationKey
+          trans_key = {static_cast<float>(t),
+                       ozz::math::Float3(static_cast<float>(val.x),
+                                         static_cast<float>(val.y),
+                                         static_cast<float>(val.z))};
+      raw_animation.tracks[track_index].translations.push_back(trans_key);
+    }
+    for (size_t i = 0; i < num_rotations; ++i) {
+      aiQuatKey k = anim_node->mRotationKeys[i];
+      double t = k.mTime / ticks_per_sec;
+      aiQuaternion val = k.mValue;
+      const ozz::animation::offline::RawAnimation::RotationKey rot_key = {
+          static_cast<float>(t),
+          ozz::math::Quaternion(
+              static_cast<float>(val.x), static_cast<float>(val.y),
+              static_cast<float>(val.z), static_cast<float>(val.w))};
+      raw_animation.tracks[track_index].rotations.push_back(rot_key);
+    }
+    for (size_t i = 0; i < num_scales; ++i) {
+      aiVectorKey k = anim_node->mScalingKeys[i];
+      double t = k.mTime / ticks_per_sec;
+      aiVector3D val = k.mValue;
+      const ozz::animation::offline::RawAnimation::ScaleKey scale_key = {
+          static_cast<float>(t),
+          ozz::math::Float3(static_cast<float>(val.x),
+                            static_cast<float>(val.y),
+                            static_cast<float>(val.z))};
+      raw_animation.tracks[track_index].scales.push_back(scale_key);
+    }
+  }
+  if (!raw_animation.Validate()) {
+    LOG(ERROR) << "Animation validate failed! :(";
+    return false;
+  } else {
+    LOG(DEBUG) << "Animation validate success! :)";
+  }
 
-  return graph_node;
+  anim_timings.begin("animation_serialize");
+  const std::string raw_anim_name =
+      anim_name.empty() ? "anim-" + std::to_string(anim_num) + "-raw.ozz"
+                        : anim_name + "-raw.ozz";
+  LOG(INFO) << "Outputting raw animation to " << raw_anim_name;
+  std::unique_ptr<buffer_stream> raw_archive =
+      archive_to_buffer(raw_animation);
+  anim_stats.bytes_written += raw_archive->Size();
+  writer.write(raw_anim_name, std::move(raw_archive));
+
+  // The raw archive above keeps every source key, only the runtime
+  // animation is built from the reduced one.
+  const ozz::animation::offline::RawAnimation *build_input = &raw_animation;
+  ozz::animation::offline::RawAnimation optimized_animation;
+  animation_report report;
+  report.name = anim_name.empty() ? std::to_string(anim_num) : anim_name;
+  count_keys(raw_animation, report.keys_in, report.raw_bytes_in);
+  if (opts.optimize_animations) {
+    anim_timings.begin("animation_optimize");
+    if (!optimize_animation(raw_animation, skeleton, opts,
+                            optimized_animation)) {
+      LOG(ERROR) << "Animation optimization failed!";
+      return false;
+    }
+    build_input = &optimized_animation;
+  }
+  count_keys(*build_input, report.keys_out, report.raw_bytes_out);
+
+  anim_timings.begin("animation_build");
+  ozz::animation::offline::AnimationBuilder builder;
+  std::unique_ptr<ozz::animation::Animation,
+                  ozz::Deleter<ozz::animation::Animation>>
+      runtime_animation = builder(*build_input);
+  if (!runtime_animation) {
+    LOG(ERROR) << "Animation build failed!";
+    return false;
+  }
+  report.runtime_bytes = runtime_animation->size();
+  print_animation_report(report);
+
+  anim_timings.begin("animation_serialize");
+  const std::string runtime_anim_name =
+      (anim_name.empty() ? std::to_string(anim_num) : anim_name) +
+      "-runtime-anim.ozz";
+  LOG(INFO) << "Outputting runtime animation to " << runtime_anim_name;
+  std::unique_ptr<buffer_stream> runtime_archive =
+      archive_to_buffer(*runtime_animation);
+  anim_stats.bytes_written += runtime_archive->Size();
+  writer.write(runtime_anim_name, std::move(runtime_archive));
+
+  if (opts.bake_frame_rate > 0.0f && !inverse_bind_matrices.empty()) {
+    anim_timings.begin("animation_bake");
+    baked_skinning baked;
+    if (!bake_skinning(*runtime_animation, skeleton, inverse_bind_matrices,
+                       opts.bake_frame_rate, baked)) {
+      LOG(ERROR) << "Skinning bake of " << report.name << " failed!";
+      return false;
+    }
+    const std::string bake_name = report.name + "-skinning.skinbake";
+    LOG(INFO) << "Outputting " << baked.frame_count << " baked frames to "
+              << bake_name;
+    std::unique_ptr<buffer_stream> bake_buffer(new buffer_stream());
+    if (!write_skinbake(baked, opts.bake_half, *bake_buffer)) {
+      LOG(ERROR) << "Could not write " << bake_name;
+      return false;
+    }
+    anim_stats.bytes_written += bake_buffer->Size();
+    writer.write(bake_name, std::move(bake_buffer));
+  }
+  if (!skinned_meshlets.empty()) {
+    anim_timings.begin("animation_meshlet_motion");
+    if (!measure_meshlet_motion(*runtime_animation, skeleton,
+                                skinned_meshlets, meshlet_motions)) {
+      LOG(ERROR) << "Meshlet motion of " << report.name << " failed!";
+      return false;
+    }
+  }
+  anim_timings.end();
+
+  anim_stats.keys_in = report.keys_in;
+  anim_stats.keys_out = report.keys_out;
+  anim_stats.runtime_bytes = report.runtime_bytes;
+  stage_timing t;
+  anim_sample.finish(t);
+  anim_stats.seconds = t.seconds;
+  anim_stats.allocations = t.allocations;
+  anim_stats.allocated_bytes = t.allocated_bytes;
+  return true;
 }
 
-void loader::hierarchy::recursive_print(lemon::ListDigraph::Node n) {
-  std::cout << "Node name = " << _name[n] << std::endl;
+bool loader::load(const aiScene *scene, const std::string &name) {
+  written_files.clear();
+  output_pathname = output_path_for(name);
+  directory_sink sink(output_pathname);
+  if (scene && !sink.create()) {
+    return false;
+  }
+  const bool success = load(scene, name, sink);
+  written_files = sink.get_files();
+  return success;
+}
 
-  for (lemon::ListDigraph::OutArcIt it(_graph, n); it != lemon::INVALID; ++it) {
-    lemon::ListDigraph::Arc arc(it);
-    lemon::ListDigraph::Node next_node = _graph.target(it);
-    recursive_print(next_node);
+bool loader::load_memory(Assimp::Importer &importer, const void *data,
+                         size_t size, const std::string &hint,
+                         const std::string &name, output_sink &sink) {
+  configure_importer(importer, opts);
+  const aiScene *scene =
+      importer.ReadFileFromMemory(data, size, import_flags_for(opts),
+                                  hint.c_str());
+  if (!scene) {
+    LOG(ERROR) << "Could not import " << name << ": "
+               << importer.GetErrorString();
+    return false;
   }
+  const bool success = load(scene, name, sink);
+  importer.FreeScene();
+  return success;
 }
 
-bool loader::load(const aiScene *scene, const std::string &name) {
+bool loader::load(const aiScene *scene, const std::string &name,
+                  output_sink &sink) {
   if (!scene) {
-    std::cout << "[Mesh] load(" << name << ") - cannot open" << std::endl;
+    LOG(ERROR) << "[Mesh] load(" << name << ") - cannot open";
     return false;
   }
+  if (opts.animations_only) {
+    ozz::animation::Skeleton skeleton;
+    if (opts.skeleton_path.empty()) {
+      LOG(ERROR) << "Converting animations only needs a skeleton";
+      return false;
+    }
+    return read_skeleton(opts.skeleton_path, skeleton) &&
+           load_animations(scene, name, skeleton, sink);
+  }
   bool has_bones = false;
   std::unordered_map<std::string, size_t> joint_indices;
   size_t num_joints = 0;
   std::set<std::string> scene_bone_names;
+  std::unique_ptr<ozz::animation::Skeleton,
+                  ozz::Deleter<ozz::animation::Skeleton>>
+      runtime_skel;
   // aiNode* scene_root = scene->mRootNode;
 
+  materials.clear();
+  timings.clear();
+  stats = conversion_stats();
+  stats.file = name;
+  const stage_sample load_sample;
+
+  // The skeleton only needs bone names, so it is built before any mesh is
+  // extracted. Meshes can then be finished and written one batch at a time.
+  timings.begin("hierarchy");
   for (size_t mesh_num = 0; mesh_num < scene->mNumMeshes; mesh_num++) {
     const aiMesh *mesh_data = scene->mMeshes[mesh_num];
-    loader::SerializedMesh temp_mesh;
-    temp_mesh.name = std::string(mesh_data->mName.C_Str());
-    std::cout << "Attempting to obtain data for mesh " << std::endl;
-    size_t num_verts = mesh_data->mNumVertices;
-    size_t num_faces = mesh_data->mNumFaces;
-    size_t num_bones = mesh_data->mNumBones;
-    has_bones = mesh_data->HasBones();
-    bool has_normals = mesh_data->HasNormals();
-    bool has_texcoords = mesh_data->HasTextureCoords(0);
-
-    temp_mesh.positions.resize(num_verts);
-    if (has_normals) {
-      temp_mesh.normals.resize(num_verts);
+    has_bones = has_bones || mesh_data->HasBones();
+    for (size_t n = 0; n < mesh_data->mNumBones; ++n) {
+      // Make sure to keep track of every bone in the scene (in order to
+      // account for multimesh models)
+      scene_bone_names.insert(
+          std::string(mesh_data->mBones[n]->mName.C_Str()));
     }
-    if (has_texcoords) {
-      temp_mesh.uvs.resize(num_verts);
-    }
-    std::cout << "Mesh " << temp_mesh.name << " (" << mesh_num << ") has "
-              << num_verts << " verts and " << num_bones << " bones. Normals? "
-              << has_normals << std::endl;
-
-    std::array<float, 3> min_extents, max_extents;
-
-    for (size_t n = 0; n < num_verts; ++n) {
-      aiVector3D pt = mesh_data->mVertices[n];
-
-      // mesh_vertex v;
-      temp_mesh.positions[n][0] = pt[0];
-      temp_mesh.positions[n][1] = pt[1];
-      temp_mesh.positions[n][2] = pt[2];
-
-      min_extents[0] = std::min(min_extents[0], pt[0]);
-      min_extents[1] = std::min(min_extents[1], pt[1]);
-      min_extents[2] = std::min(min_extents[2], pt[2]);
-      max_extents[0] = std::max(max_extents[0], pt[0]);
-      max_extents[1] = std::max(max_extents[1], pt[1]);
-      max_extents[2] = std::max(max_extents[2], pt[2]);
-
-      if (has_normals) {
-        aiVector3D normal = mesh_data->mNormals[n];
-        temp_mesh.normals[n][0] = normal[0];
-        temp_mesh.normals[n][1] = normal[1];
-        temp_mesh.normals[n][2] = normal[2];
-      }
-      if (has_texcoords) {
-        aiVector3D uv = mesh_data->mTextureCoords[0][n];
-        temp_mesh.uvs[n][0] = uv.x;
-        temp_mesh.uvs[n][1] = uv.y;
-      }
-    }
-
-    std::array<float, 3> temp_dims;
-    for (size_t i = 0; i < 3; ++i) {
-      temp_dims[i] = max_extents[i] - min_extents[i];
-    }
-
-    temp_mesh.dimensions = temp_dims;
-
-    for (size_t face_id = 0; face_id < num_faces; ++face_id) {
-      aiFace face = mesh_data->mFaces[face_id];
-      if (face.mNumIndices == 3) {
-        temp_mesh.indices.push_back(face.mIndices[0]);
-        temp_mesh.indices.push_back(face.mIndices[1]);
-        temp_mesh.indices.push_back(face.mIndices[2]);
-      }
-      // else {
-      //   std::cout<< "Found faces with " << face.mNumIndices << " indicce" <<
-      //   std::endl;
-      // }
-    }
-
-    if (has_bones) {
-      temp_mesh.vert_bone_names.resize(num_verts);
-      // temp_mesh.bone_names.reserve(num_bones);
-      temp_mesh.bone_indices.resize(num_verts);
-      temp_mesh.bone_weights.resize(num_verts);
-
-      for (size_t n = 0; n < num_bones; ++n) {
-        aiBone *bone_data = mesh_data->mBones[n];
-        std::string temp_bone_name = std::string(bone_data->mName.C_Str());
-        // TODO: Remove
-        std::cout << temp_bone_name << " " << temp_mesh.bone_names.size()
-                  << std::endl;
-        temp_mesh.bone_names.push_back(temp_bone_name);
-
-        // Make sure to keep track of every bone in the scene (in order to
-        // account for multimesh models)
-        scene_bone_names.insert(temp_bone_name);
-        // Store the bone names and weights in the vert data.
-        for (uint32_t i = 0; i < bone_data->mNumWeights; ++i) {
-          size_t bone_vertex_id = bone_data->mWeights[i].mVertexId;
-
-          for (size_t j = 0; j < 4; ++j) {
-            if (temp_mesh.bone_weights[bone_vertex_id][j] == 0.0) {
-              temp_mesh.vert_bone_names[bone_vertex_id][j] = temp_bone_name;
-              temp_mesh.bone_weights[bone_vertex_id][j] =
-                  bone_data->mWeights[i].mWeight;
-              break;
-            }
-          }
-        }
-      }
-      temp_mesh.material_index = mesh_data->mMaterialIndex;
-    }
-    meshes.push_back(temp_mesh);
   }
 
-  std::cout << "Total of " << meshes.size() << " meshes in file " << name << "."
-            << std::endl;
+  std::vector<std::string> joint_names_str;
+  std::vector<std::array<float, 16>> inverse_bind_matrices;
   if (has_bones) {
     loader::hierarchy bone_hierarchy;
 
@@ -301,114 +681,47 @@ bool loader::load(const aiScene *scene, const std::string &name) {
         bone_hierarchy.make_raw_skeleton();
 
     if (!raw_skel.Validate()) {
-      std::cout << "Skeleton validation failed!" << std::endl;
+      LOG(ERROR) << "Skeleton validation failed!";
       return false;
     } else {
-      std::cout << "Skeleton validation success!" << std::endl;
+      LOG(DEBUG) << "Skeleton validation success!";
     }
 
+    timings.begin("skeleton_build");
     ozz::animation::offline::SkeletonBuilder skel_builder;
-    std::unique_ptr<ozz::animation::Skeleton,
-                    ozz::Deleter<ozz::animation::Skeleton>>
-        runtime_skel = skel_builder(raw_skel);
-
-    std::string output_base_pathname = "./output/";
-
-    try {
-      boost::filesystem::create_directory(
-          boost::filesystem::path(output_base_pathname));
-    } catch (std::exception &e) {
-      std::cout << "Could not create base path: " << output_base_pathname;
-      return false;
-    }
-    output_pathname = output_base_pathname + name;
+    runtime_skel = skel_builder(raw_skel);
 
-    try {
-      boost::filesystem::create_directory(
-          boost::filesystem::path(output_pathname));
-    }
-
-    catch (std::exception &e) {
-      std::cout << "Could not create path: " << output_pathname;
-      return false;
-    }
+    timings.begin("skeleton_write");
 
     // Most of the time, the user will want to use the runtime skeleton, but at
     // this point we give option for both.
-    std::ostringstream output_raw_skel_filename;
-    output_raw_skel_filename << output_pathname << "/raw-skeleton.ozz";
-    std::string filename = output_raw_skel_filename.str();
-    std::cout << "Outputting raw skeleton to " << output_raw_skel_filename.str()
-              << std::endl;
-    ozz::io::File output_raw_skel_file(output_raw_skel_filename.str().c_str(),
-                                       "wb");
-    ozz::io::OArchive raw_skel_archive(&output_raw_skel_file);
-    raw_skel_archive << raw_skel;
-
-    std::ostringstream output_runtime_skel_filename;
-    output_runtime_skel_filename << output_pathname << "/runtime-skeleton.ozz";
-    std::cout << "Outputting runtime skeleton to "
-              << output_runtime_skel_filename.str() << std::endl;
-    ozz::io::File output_runtime_skel_file(
-        output_runtime_skel_filename.str().c_str(), "wb");
-    ozz::io::OArchive runtime_skel_archive(&output_runtime_skel_file);
-    runtime_skel_archive << *runtime_skel;
+    LOG(INFO) << "Outputting raw skeleton to raw-skeleton.ozz";
+    size_t written = write_archive(sink, "raw-skeleton.ozz", raw_skel);
+    LOG(INFO) << "Outputting runtime skeleton to runtime-skeleton.ozz";
+    const size_t runtime_written =
+        write_archive(sink, "runtime-skeleton.ozz", *runtime_skel);
+    if (written == 0 || runtime_written == 0) {
+      LOG(ERROR) << "Could not write the skeleton of " << name;
+      return false;
+    }
+    stats.bytes_written += written + runtime_written;
 
     // This bit of code allows the animation to use the skeleton indices from
     // the ozz skeleton structure.
-    // TODO: Find out if necessary.
     ozz::span<const char *const> joint_names = runtime_skel->joint_names();
     num_joints = runtime_skel->num_joints();
-
-    std::vector<std::string> joint_names_str;
+    stats.joints = num_joints;
 
     for (size_t i = 0; i < num_joints; ++i) {
       std::string s = std::string(joint_names[i]);
       joint_indices.insert(std::make_pair(s, i));
       joint_names_str.push_back(s);
     }
-
-    // std::cout << "Displaying ozz skeleton joint names and indices" <<
-    // std::endl;
-
-    //   for (auto it = joint_indices.begin(); it != joint_indices.end(); it++)
-    //   {
-    //     std::cout << "Name = " << it->first << ", index = " << it->second
-    //               << std::endl;
-    //   }
-    // Now, get the bone names from each vertex and insert the matching bone
-    // indices.
-    for (size_t mesh_index = 0; mesh_index < meshes.size(); ++mesh_index) {
-      loader::SerializedMesh m = meshes[mesh_index];
-      m.bone_names = joint_names_str;
-      std::cout << std::endl;
-      for (size_t vert_index = 0; vert_index < m.positions.size();
-           ++vert_index) {
-        // mesh_vertex v = m.vertices[vert_index];
-        //if (m.vert_bone_names.size() == m.bone_indices.size() ==
-        //    m.positions.size()) {
-          for (size_t i = 0; i < m.vert_bone_names[vert_index].size(); ++i) {
-            std::string s = m.vert_bone_names[vert_index][i];
-            if (!s.empty()) {
-              auto it = joint_indices.find(s);
-              if (it != joint_indices.end()) {
-                m.bone_indices[vert_index][i] = joint_indices.find(s)->second;
-                // std::cout << "Found index " << v.bone_indices[i]
-                //           << " for bone name " << v.bone_names[i] <<
-                //           std::endl;
-              } else {
-                std::cout << "ERROR! Could not find bone index for " << s
-                          << " in joint indices map!!!" << std::endl;
-                return false;
-              }
-            }
-         // }
-        }
-      }
-      meshes[mesh_index] = m;
-      bool did_empty = meshes[mesh_index].vert_bone_names.empty();
-    }
+    inverse_bind_matrices = merge_inverse_bind_matrices(scene, joint_indices);
   }
+
+  timings.end();
+
   // Read in materials
   const bool has_materials = scene->HasMaterials();
   if (has_materials) {
@@ -435,189 +748,282 @@ bool loader::load(const aiScene *scene, const std::string &name) {
     }
   }
 
-  loader::SerializedModel temp_model;
-  for (auto m : meshes) {
-    temp_model.meshes.push_back(m);
-  }
-  for (auto m: materials) {
-    temp_model.materials.push_back(m);
+  model_writer writer(opts);
+  if (!writer.begin(sink)) {
+    return false;
   }
 
-
-  std::ofstream output_file;
-  output_file.open(output_pathname + "/model.json");
-  // auto data = sbuf.data();
-  // for (size_t i = 0; i < sbuf.size(); ++i) {
-  //   output_file.put(data[i]);
-  // }
-  cereal::JSONOutputArchive output(output_file); // stream to cout
-
-  output( cereal::make_nvp("model",temp_model));
-
-  std::cout << "Writing model file to " << output_pathname + "/model.json"
-            << std::endl;
-  // std::cout << "Buffer size: " << buffer.size() << std::endl;
-
-  output_file.close();
-
-  if (has_bones) {
-    std::vector<ozz::animation::offline::RawAnimation> raw_animations;
-
-    size_t num_anims = scene->mNumAnimations;
-
-    for (size_t anim_num = 0; anim_num < num_anims; ++anim_num) {
-      aiAnimation *anim = scene->mAnimations[anim_num];
-      double ticks = anim->mDuration;
-      double ticks_per_sec = anim->mTicksPerSecond;
-      size_t num_unfiltered_channels = anim->mNumChannels;
-
-      if (ticks_per_sec < 0.0001) {
-        ticks_per_sec = 1.0;
+  // Every aiMesh is independent, so extraction runs on several threads. Each
+  // one writes its own slot, which keeps the mesh order of the scene. By
+  // default the whole scene is one batch; when streaming, a batch is one
+  // mesh per thread, written and freed before the next batch is extracted.
+  const size_t num_meshes = scene->mNumMeshes;
+  const size_t batch_size = opts.stream_meshes
+                                ? resolve_jobs(opts.jobs)
+                                : std::max<size_t>(num_meshes, 1);
+  std::vector<vertex_cache_report> cache_reports;
+  // Skinned meshlets are bounded by the animations, converted last.
+  const bool animate_meshlets =
+      opts.build_meshlets && has_bones && scene->mNumAnimations > 0;
+  // Finished meshes held for merging, which needs all of them, or until the
+  // animations have bounded their meshlets.
+  std::vector<loader::SerializedMesh> held;
+  if (opts.stream_meshes && animate_meshlets && !opts.merge_meshes) {
+    LOG(WARNING) << "Meshes of " << name << " are held until its animations "
+                 << "bound their meshlets, which defeats --stream.";
+  }
+  // Extraction, vertex cache and LODs of each mesh, measured on the thread
+  // processing it and added to the stage timings after each batch.
+  std::vector<std::array<stage_timing, 3>> mesh_samples;
+  for (size_t first = 0; first < num_meshes; first += batch_size) {
+    const size_t count = std::min(batch_size, num_meshes - first);
+    meshes.clear();
+    meshes.resize(count);
+    cache_reports.assign(count, vertex_cache_report());
+    mesh_samples.assign(count, std::array<stage_timing, 3>());
+    parallel_for(count, opts.jobs, [&](size_t i) {
+      std::array<stage_timing, 3> &samples = mesh_samples[i];
+      stage_sample extract;
+      extract_mesh(scene->mMeshes[first + i], meshes[i]);
+      extract.finish(samples[0]);
+      stage_sample cache;
+      if (opts.optimize_vertex_cache) {
+        optimize_mesh_vertex_cache(meshes[i], cache_reports[i]);
+      }
+      cache.finish(samples[1]);
+      stage_sample lods;
+      generate_lods(meshes[i], opts);
+      lods.finish(samples[2]);
+    });
+
+    for (size_t i = 0; i < count; ++i) {
+      const size_t mesh_num = first + i;
+      const aiMesh *mesh_data = scene->mMeshes[mesh_num];
+      loader::SerializedMesh &temp_mesh = meshes[i];
+
+      mesh_stats m;
+      m.name = temp_mesh.name;
+      m.source_vertices = mesh_data->mNumVertices;
+      m.source_faces = mesh_data->mNumFaces;
+      m.bones = mesh_data->mNumBones;
+      const char *stages[] = {"extract_meshes", "vertex_cache", "lods"};
+      for (size_t k = 0; k < 3; ++k) {
+        stage_timing &t = mesh_samples[i][k];
+        t.stage = stages[k];
+        timings.add(t);
+        m.seconds += t.seconds;
+        m.allocations += t.allocations;
+        m.allocated_bytes += t.allocated_bytes;
       }
 
-      std::string anim_name = std::string(anim->mName.C_Str());
-      std::cout << "Assimp animation " << anim_num + 1 << " out of "
-                << num_anims << ". Name: " << anim_name << ". Ticks = " << ticks
-                << ". Ticks per second = " << ticks_per_sec
-                << ". Number of (unfiltered) channels = "
-                << num_unfiltered_channels << std::endl;
-
-      ozz::animation::offline::RawAnimation raw_animation;
-      raw_animation.duration = ticks * ticks_per_sec;
-
-      // Filter out the anim nodes that aren't bones.
-      // TODO: Find out whether this is necessary or desirable
-      std::set<std::tuple<size_t, aiNodeAnim *>> valid_channels;
-      for (size_t num = 0; num < num_unfiltered_channels; ++num) {
-        aiNodeAnim *anim_node = anim->mChannels[num];
-        std::string anim_node_name = std::string(anim_node->mNodeName.C_Str());
-        auto it = joint_indices.find(anim_node_name);
-        if (it != joint_indices.end()) {
-          size_t anim_node_skeleton_index = it->second;
-          valid_channels.insert(
-              std::make_tuple(anim_node_skeleton_index, anim_node));
-          // std::cout << "Found node " << anim_node_name << " for animation
-          // track
-          // "
-          //          << num << "." << std::endl;
-        } else {
-          // std::cout << "Could not find node " << anim_node_name
-          //          << " required to build animation track " << num
-          //          << ". Skipping." << std::endl;
-          continue;
-        }
+      LOG(INFO) << "Mesh " << temp_mesh.name << " (" << mesh_num << ") has "
+                << mesh_data->mNumVertices << " verts and "
+                << mesh_data->mNumBones << " bones. Normals? "
+                << mesh_data->HasNormals();
+      if (opts.optimize_vertex_cache) {
+        print_vertex_cache_report(cache_reports[i]);
       }
+      print_lods(temp_mesh);
 
-      raw_animation.tracks.resize(num_joints);
-      for (std::tuple<size_t, aiNodeAnim *> chan : valid_channels) {
-        size_t track_index = std::get<0>(chan);
-        aiNodeAnim *anim_node = std::get<1>(chan);
-
-        size_t num_translations = anim_node->mNumPositionKeys;
-        size_t num_rotations = anim_node->mNumRotationKeys;
-        size_t num_scales = anim_node->mNumScalingKeys;
-
-        // std::cout << "Bone " << anim_node->mNodeName.C_Str()
-        //           << ", skeleton index " << track_index << " - Inserting "
-        //           << num_translations << " translations, " << num_rotations
-        //           << " rotations, " << num_scales << " scales." << std::endl;
-
-        for (size_t i = 0; i < num_translations; ++i) {
-          // std::cout << "Inserting translation num " << i << ": ";
-          aiVectorKey k = anim_node->mPositionKeys[i];
-          double t = k.mTime;
-          aiVector3D val = k.mValue;
-          // std::cout << " time = " << t << ", (" << val.x << ", " << val.y <<
-          // ",
-          // "
-          //          << val.z << ")" << std::endl;
-          const ozz::animation::offline::RawAnimation::TranslationKey
-              trans_key = {static_cast<float>(t),
-                           ozz::math::Float3(static_cast<float>(val.x),
-                                             static_cast<float>(val.y),
-                                             static_cast<float>(val.z))};
-          raw_animation.tracks[track_index].translations.push_back(trans_key);
-        }
-        for (size_t i = 0; i < num_rotations; ++i) {
-          // // std::cout << "Inserting rotation num " << i << ": ";
-          aiQuatKey k = anim_node->mRotationKeys[i];
-          double t = k.mTime;
-          aiQuaternion val = k.mValue;
-          // std::cout << " time = " << t << ", (" << val.x << ", " << val.y <<
-          // ",
-          // "
-          //          << val.z << ", " << val.w << ")" << std::endl;
-
-          const ozz::animation::offline::RawAnimation::RotationKey rot_key = {
-              static_cast<float>(t),
-              ozz::math::Quaternion(
-                  static_cast<float>(val.x), static_cast<float>(val.y),
-                  static_cast<float>(val.z), static_cast<float>(val.w))};
-          raw_animation.tracks[track_index].rotations.push_back(rot_key);
-        }
-        for (size_t i = 0; i < num_scales; ++i) {
-          // std::cout << "Inserting scale num " << i << std::endl;
-          aiVectorKey k = anim_node->mScalingKeys[i];
-          double t = k.mTime;
-          aiVector3D val = k.mValue;
-          // std::cout << " time = " << t << ", (" << val.x << ", " << val.y <<
-          // ",
-          // "
-          //          << val.z << ")" << std::endl;
-          const ozz::animation::offline::RawAnimation::ScaleKey scale_key = {
-              static_cast<float>(t),
-              ozz::math::Float3(static_cast<float>(val.x),
-                                static_cast<float>(val.y),
-                                static_cast<float>(val.z))};
-          raw_animation.tracks[track_index].scales.push_back(scale_key);
-        }
+      timings.begin("joint_remap");
+      if (has_bones &&
+          !assign_joints(temp_mesh, joint_indices, joint_names_str,
+                         inverse_bind_matrices)) {
+        return false;
+      }
+      if (opts.build_meshlets) {
+        timings.begin("meshlets");
+        meshlet_report report;
+        build_meshlets(temp_mesh, opts.max_meshlet_vertices,
+                       opts.max_meshlet_triangles, report);
+        print_meshlet_report(report);
       }
-      if (!raw_animation.Validate()) {
-        std::cout << "Animation validate failed! :(" << std::endl;
-        return -3;
-      } else {
-        std::cout << "Animation validate success! :)" << std::endl;
+      m.vertices = temp_mesh.positions.size();
+      m.triangles = temp_mesh.indices.size() / 3;
+      m.lods = temp_mesh.lods.size();
+      m.submeshes = temp_mesh.submeshes.size();
+      m.meshlets = temp_mesh.meshlets.size();
+
+      stats.meshes.push_back(m);
+      if (opts.merge_meshes || animate_meshlets) {
+        // Held meshes are written together, so these report 0 bytes.
+        held.push_back(std::move(temp_mesh));
+        continue;
       }
+      timings.begin("model_write");
+      const size_t written = writer.bytes_written();
+      if (!writer.add_mesh(std::move(temp_mesh))) {
+        return false;
+      }
+      stats.meshes.back().bytes_written = writer.bytes_written() - written;
+      timings.end();
+    }
+  }
+  meshes.clear();
+  LOG(INFO) << "Total of " << num_meshes << " meshes in file " << name << ".";
+
+  if (opts.merge_meshes) {
+    timings.begin("merge");
+    merge_report report;
+    merge_meshes(held, materials, report);
+    print_merge_report(report);
+  }
+  std::vector<skinned_meshlet> skinned_meshlets;
+  if (animate_meshlets) {
+    skinned_meshlets = collect_skinned_meshlets(held);
+  }
 
-      std::ostringstream output_raw_anim_filename;
-      if (anim_name.empty()) {
-        output_raw_anim_filename << output_pathname << "/" << "anim-"
-                                 << anim_num << "-raw.ozz";
-      } else {
-        output_raw_anim_filename << output_pathname << "/" << anim_name
-                                 << "-raw.ozz";
+  const auto write_model = [&]() {
+    timings.begin("model_write");
+    for (loader::SerializedMesh &m : held) {
+      if (!writer.add_mesh(std::move(m))) {
+        return false;
       }
-      std::cout << "Outputting raw animation to "
-                << output_raw_anim_filename.str() << std::endl;
-
-      ozz::io::File output_raw_anim_file(output_raw_anim_filename.str().c_str(),
-                                         "wb");
-      ozz::io::OArchive raw_anim_archive(&output_raw_anim_file);
-      raw_anim_archive << raw_animation;
-
-      ozz::animation::offline::AnimationBuilder builder;
-      std::unique_ptr<ozz::animation::Animation,
-                      ozz::Deleter<ozz::animation::Animation>>
-          runtime_animation = builder(raw_animation);
-
-      std::ostringstream output_runtime_anim_filename;
-      output_runtime_anim_filename << output_pathname << "/";
-      if (anim_name.empty()) {
-        output_runtime_anim_filename << anim_num;
-      } else {
-        output_runtime_anim_filename << anim_name;
+    }
+    held.clear();
+    if (!writer.finish(materials)) {
+      return false;
+    }
+    timings.end();
+    stats.bytes_written += writer.bytes_written();
+    return true;
+  };
+  if (skinned_meshlets.empty() && !write_model()) {
+    return false;
+  }
+
+  if (has_bones) {
+    ozz::vector<ozz::math::Float4x4> bake_inverse_binds;
+    if (opts.bake_frame_rate > 0.0f) {
+      bake_inverse_binds = load_inverse_bind_matrices(inverse_bind_matrices);
+    }
+    std::vector<meshlet_motion> motions;
+    if (!convert_animations(scene, joint_indices, *runtime_skel,
+                            bake_inverse_binds, skinned_meshlets, sink,
+                            motions)) {
+      return false;
+    }
+    if (!skinned_meshlets.empty()) {
+      timings.begin("meshlet_bounds");
+      expand_skinned_meshlets(held, skinned_meshlets, motions);
+      if (!write_model()) {
+        return false;
       }
+    }
+  }
+
+  finish_stats(load_sample);
+  return true;
+}
 
-      output_runtime_anim_filename << "-runtime-anim.ozz";
-      std::cout << "Outputting runtime animation to "
-                << output_runtime_anim_filename.str() << std::endl;
+bool loader::load_animations(const aiScene *scene, const std::string &name,
+                             const ozz::animation::Skeleton &skeleton,
+                             output_sink &sink) {
+  if (!scene) {
+    LOG(ERROR) << "[Mesh] load_animations(" << name << ") - cannot open";
+    return false;
+  }
+  materials.clear();
+  timings.clear();
+  stats = conversion_stats();
+  stats.file = name;
+  const stage_sample load_sample;
 
-      ozz::io::File output_runtime_anim_file(
-          output_runtime_anim_filename.str().c_str(), "wb");
-      ozz::io::OArchive runtime_anim_archive(&output_runtime_anim_file);
-      runtime_anim_archive << *runtime_animation;
+  const ozz::span<const char *const> joint_names = skeleton.joint_names();
+  std::unordered_map<std::string, size_t> joint_indices;
+  for (size_t i = 0; i < joint_names.size(); ++i) {
+    joint_indices.insert(std::make_pair(std::string(joint_names[i]), i));
+  }
+  stats.joints = joint_names.size();
+  if (opts.bake_frame_rate > 0.0f) {
+    LOG(WARNING) << "Skinning bakes need the inverse bind matrices of the "
+                    "meshes, skipped when converting animations only.";
+  }
+
+  std::vector<meshlet_motion> motions;
+  if (!convert_animations(scene, joint_indices, skeleton,
+                          ozz::vector<ozz::math::Float4x4>(),
+                          std::vector<skinned_meshlet>(), sink, motions)) {
+    return false;
+  }
+  finish_stats(load_sample);
+  return true;
+}
+
+bool loader::convert_animations(
+    const aiScene *scene,
+    const std::unordered_map<std::string, size_t> &joint_indices,
+    const ozz::animation::Skeleton &skeleton,
+    const ozz::vector<ozz::math::Float4x4> &inverse_bind_matrices,
+    const std::vector<skinned_meshlet> &skinned_meshlets, output_sink &sink,
+    std::vector<meshlet_motion> &motions) {
+  // Clips only share the scene and the skeleton, so they are built on
+  // several threads. Their archives are serialized there too, then written
+  // by a background thread while the next clips build.
+  const size_t num_anims = scene->mNumAnimations;
+  std::vector<stage_timings> anim_timings(num_anims);
+  std::vector<animation_stats> anim_stats(num_anims);
+  std::vector<char> anim_converted(num_anims, 0);
+  std::vector<std::vector<meshlet_motion>> meshlet_motions(num_anims);
+  async_writer archive_writer(sink, 2 * resolve_jobs(opts.jobs));
+  parallel_for(num_anims, opts.jobs, [&](size_t i) {
+    anim_converted[i] = convert_animation(
+        scene->mAnimations[i], i, num_anims, joint_indices, skeleton,
+        inverse_bind_matrices, skinned_meshlets, archive_writer,
+        anim_timings[i], anim_stats[i], meshlet_motions[i]);
+  });
+  const bool archives_written = archive_writer.finish();
+
+  for (size_t i = 0; i < num_anims; ++i) {
+    for (const stage_timing &t : anim_timings[i].get()) {
+      timings.add(t);
+    }
+    stats.bytes_written += anim_stats[i].bytes_written;
+    stats.animations.push_back(anim_stats[i]);
+  }
+  stage_timing write_timing = archive_writer.get_timing();
+  write_timing.stage = "animation_write";
+  timings.add(write_timing);
+
+  motions.assign(skinned_meshlets.size(), meshlet_motion());
+  for (const std::vector<meshlet_motion> &clip : meshlet_motions) {
+    for (size_t i = 0; i < clip.size() && i < motions.size(); ++i) {
+      motions[i].displacement =
+          std::max(motions[i].displacement, clip[i].displacement);
+      motions[i].angle = std::max(motions[i].angle, clip[i].angle);
     }
   }
+  return archives_written &&
+         std::find(anim_converted.begin(), anim_converted.end(), 0) ==
+             anim_converted.end();
+}
+
+void loader::finish_stats(const stage_sample &load_sample) {
+  stage_timing total;
+  load_sample.finish(total);
+  stats.seconds = total.seconds;
+  stats.peak_rss_bytes = total.peak_rss_bytes;
+  stats.success = true;
+  LOG(INFO) << "Peak memory: " << stats.peak_rss_bytes / (1024 * 1024)
+            << " MB";
+}
 
+bool loader::read_skeleton(const std::string &path,
+                           ozz::animation::Skeleton &skeleton) {
+  ozz::io::File file(path.c_str(), "rb");
+  if (!file.opened()) {
+    LOG(ERROR) << "Could not open skeleton " << path;
+    return false;
+  }
+  ozz::io::IArchive archive(&file);
+  if (!archive.TestTag<ozz::animation::Skeleton>()) {
+    LOG(ERROR) << path << " is not a runtime skeleton archive";
+    return false;
+  }
+  archive >> skeleton;
   return true;
 }
+
+unsigned int loader::import_flags_for(const options &opts) {
+  return opts.animations_only ? 0u : opts.import_flags;
+}
@@ -2,9 +2,11 @@
 // loads proper mesh data to use alongside it in an engine neutral format.
 // Enjoy. MIT license. Colin Gilbert
 
-// TODO: Options via config file
+#pragma once
 
 #include "cereal/cereal.hpp"
+#include "conversion_stats.hpp"
+#include "output_sink.hpp"
 #include <array>
 #include <assimp/Importer.hpp>
 #include <assimp/material.h>
@@ -13,17 +15,26 @@
 #include <boost/filesystem.hpp>
 #include <cereal/archives/json.hpp>
 #include <cereal/types/array.hpp>
+#include <cereal/types/map.hpp>
+#include <cereal/types/string.hpp>
 #include <cereal/types/vector.hpp>
-#include <lemon/list_graph.h>
 #include <map>
 #include <ozz/animation/offline/raw_skeleton.h>
+#include <ozz/animation/runtime/skeleton.h>
+#include <ozz/base/containers/vector.h>
 #include <ozz/base/io/archive.h>
 #include <ozz/base/io/stream.h>
+#include <ozz/base/maths/simd_math.h>
 #include <set>
 #include <string>
 #include <sys/types.h>
+#include <unordered_map>
 #include <vector>
 
+class async_writer;
+struct meshlet_motion;
+struct skinned_meshlet;
+
 class loader {
 public:
   //   struct mesh_vertex {
@@ -39,25 +50,127 @@ public:
   //     std::array<float, 4> bone_weights;
   //   };
 
+  // A range of an index buffer drawn with its own joint palette, see
+  // palette.hpp. bone_indices of the vertices it uses index `palette`,
+  // which maps them to skeleton joints.
+  struct SerializedSubmesh {
+    uint32_t index_offset;
+    uint32_t index_count;
+    std::vector<uint32_t> palette;
+    friend class cereal::access;
+    template <class Archive> void serialize(Archive &archive) {
+      archive(CEREAL_NVP(index_offset), CEREAL_NVP(index_count),
+              CEREAL_NVP(palette));
+    }
+  };
+
+  // The part of a merged mesh that came from one source mesh, see
+  // mesh_merge.hpp. Its indices are relative to vertex_offset, the base
+  // vertex to draw it with. Drawing every range of a mesh draws its whole
+  // index buffer; a range alone draws one source mesh, ie to hide it.
+  struct SerializedRange {
+    std::string name;
+    uint32_t index_offset;
+    uint32_t index_count;
+    uint32_t vertex_offset;
+    uint32_t vertex_count;
+    // At most 65536 vertices, so that its indices fit 16 bits.
+    bool short_indices;
+    friend class cereal::access;
+    template <class Archive> void serialize(Archive &archive) {
+      archive(CEREAL_NVP(name), CEREAL_NVP(index_offset),
+              CEREAL_NVP(index_count), CEREAL_NVP(vertex_offset),
+              CEREAL_NVP(vertex_count), CEREAL_NVP(short_indices));
+    }
+  };
+
+  // An axis-aligned box, see bounds.hpp. Empty boxes have min greater than
+  // max.
+  struct SerializedBounds {
+    std::array<float, 3> min;
+    std::array<float, 3> max;
+    friend class cereal::access;
+    template <class Archive> void serialize(Archive &archive) {
+      archive(CEREAL_NVP(min), CEREAL_NVP(max));
+    }
+  };
+
+  // A cluster of consecutive triangles of the mesh indices, with the bounds
+  // to cull it on its own, see meshlet.hpp. The cluster is outside the
+  // frustum if its sphere is, and faces away from a camera at `eye` if
+  //   dot(center - eye, cone_axis) >=
+  //       cone_cutoff * length(center - eye) + radius
+  // A cone_cutoff of 1 means the cluster cannot be culled that way.
+  struct SerializedMeshlet {
+    uint32_t index_offset;
+    uint32_t index_count;
+    uint32_t vertex_count; // Distinct vertices.
+    std::array<float, 3> center;
+    float radius;
+    std::array<float, 3> cone_axis;
+    float cone_cutoff;
+    friend class cereal::access;
+    template <class Archive> void serialize(Archive &archive) {
+      archive(CEREAL_NVP(index_offset), CEREAL_NVP(index_count),
+              CEREAL_NVP(vertex_count), CEREAL_NVP(center),
+              CEREAL_NVP(radius), CEREAL_NVP(cone_axis),
+              CEREAL_NVP(cone_cutoff));
+    }
+  };
+
+  // A simplified index buffer over the vertices of its mesh.
+  struct SerializedLod {
+    std::vector<uint32_t> indices;
+    std::vector<SerializedSubmesh> submeshes;
+    // Same as SerializedMesh::ranges, over these indices.
+    std::vector<SerializedRange> ranges;
+    // Largest distance the surface moved, in model units. Projected to the
+    // screen, this tells when the LOD can be switched to.
+    float error;
+    // error relative to the largest dimension of the mesh.
+    float relative_error;
+    friend class cereal::access;
+    template <class Archive> void serialize(Archive &archive) {
+      archive(CEREAL_NVP(indices), CEREAL_NVP(submeshes), CEREAL_NVP(ranges),
+              CEREAL_NVP(error), CEREAL_NVP(relative_error));
+    }
+  };
+
   struct SerializedMesh {
     std::string name;
     std::array<float, 3> translation, scale, dimensions;
     std::array<float, 4> rotation;
+    // Of the positions, in mesh space.
+    SerializedBounds bounds;
     std::vector<std::array<float, 3>> positions, normals;
     std::vector<std::array<float, 2>> uvs;
-    std::vector<std::array<std::string, 4>>
-        vert_bone_names; // Used to calculate bone indices and weights
     std::vector<std::array<uint32_t, 4>> bone_indices;
     std::vector<std::array<float, 4>> bone_weights;
     std::vector<uint32_t> indices;
+    // Empty unless palettes are enabled. Then bone_indices are local to the
+    // palette of the submesh drawing the vertex.
+    std::vector<SerializedSubmesh> submeshes;
+    std::vector<SerializedLod> lods; // LOD1 and up, see lod.hpp
+    // Empty unless several source meshes were merged into this one.
+    std::vector<SerializedRange> ranges;
+    // Empty unless meshlets are enabled. They cover `indices` in order.
+    std::vector<SerializedMeshlet> meshlets;
     std::vector<std::string> bone_names;
+    // Inverse bind matrix of each entry of bone_names, from
+    // aiBone::mOffsetMatrix, column-major like ozz::math::Float4x4. Empty
+    // unless the mesh is skinned.
+    std::vector<std::array<float, 16>> inverse_bind_matrices;
+    // Box of the vertices of each entry of bone_names, in its bind space,
+    // see compute_joint_bounds. Empty unless the mesh is skinned.
+    std::vector<SerializedBounds> joint_bounds;
     uint32_t material_index;
     friend class cereal::access;
     template <class Archive> void serialize(Archive &archive) {
       archive(CEREAL_NVP(name), CEREAL_NVP(translation), CEREAL_NVP(scale),
-              CEREAL_NVP(dimensions), CEREAL_NVP(rotation),
+              CEREAL_NVP(dimensions), CEREAL_NVP(rotation), CEREAL_NVP(bounds),
               CEREAL_NVP(positions), CEREAL_NVP(normals), CEREAL_NVP(uvs),
-              CEREAL_NVP(bone_indices), CEREAL_NVP(bone_weights),  CEREAL_NVP(indices), CEREAL_NVP(bone_names),
+              CEREAL_NVP(bone_indices), CEREAL_NVP(bone_weights),  CEREAL_NVP(indices), CEREAL_NVP(submeshes), CEREAL_NVP(lods), CEREAL_NVP(ranges), CEREAL_NVP(meshlets), CEREAL_NVP(bone_names),
+              CEREAL_NVP(inverse_bind_matrices), CEREAL_NVP(joint_bounds),
               CEREAL_NVP(material_index));
     }
   };
@@ -90,50 +203,269 @@ public:
     }
   };
 
+  // Joints of the skeleton as flat arrays, in depth-first order so that
+  // parents always come before their children.
   class hierarchy {
   public:
-    hierarchy()
-        : _translation(_graph), _scale(_graph), _rotation(_graph),
-          _name(_graph) {}
-
+    // Walks the node tree once. Joints are the nodes named in bone_names
+    // (the first node found for each name). A joint whose parent node is not
+    // a joint becomes a root.
     void init(const aiScene *scene, const std::set<std::string> &bone_names);
 
-    ozz::animation::offline::RawSkeleton make_raw_skeleton();
+    // Builds the nested RawSkeleton from the flat arrays, without recursion.
+    ozz::animation::offline::RawSkeleton make_raw_skeleton() const;
+
+    void print_info() const;
+
+    size_t size() const { return _names.size(); }
 
-    void print_info();
+    const std::vector<std::string> &names() const { return _names; }
+
+    // Index of the parent of each joint, -1 for roots.
+    const std::vector<int> &parents() const { return _parents; }
 
   protected:
-    std::vector<lemon::ListDigraph::Node> find_roots();
+    std::vector<std::string> _names;
+    std::vector<int> _parents;
+    std::vector<ozz::math::Transform> _transforms;
+  };
 
-    void recursive_build(aiNode *current,
-                         const std::set<std::string> &bone_names);
+  // Format of the model file written next to the ozz archives.
+  enum class output_format {
+    JSON,    // model.json through cereal
+    CAPNP,   // model.capnp using model3d_schema.capnp
+    OZZMESH, // model.ozzmesh, memory-mappable streams, see ozzmesh.hpp
+  };
 
-    void link(aiNode *parent, aiNode *child);
+  // Error allowed when optimizing animations: `tolerance` (in model units,
+  // ie meters) measured at `distance` from the joint. The defaults are ozz's.
+  struct animation_tolerance {
+    float tolerance = 1e-3f;
+    float distance = 1e-1f;
 
-    lemon::ListDigraph::Node add(aiNode *assimp_node);
+    template <class Archive> void serialize(Archive &archive) {
+      archive(CEREAL_NVP(tolerance), CEREAL_NVP(distance));
+    }
+  };
 
-    void recursive_ozz_helper(
-        const lemon::ListDigraph::Node &n,
-        ozz::animation::offline::RawSkeleton::Joint &caller_joint,
-        size_t index);
+  // A LOD stops simplifying at `ratio` of the triangles of LOD0, or before
+  // its error passes `max_error` (relative to the mesh size), whichever
+  // comes first.
+  struct lod_level {
+    float ratio = 0.0f;
+    float max_error = 1.0f;
 
-    void recursive_print(lemon::ListDigraph::Node n);
+    template <class Archive> void serialize(Archive &archive) {
+      archive(CEREAL_NVP(ratio), CEREAL_NVP(max_error));
+    }
+  };
+
+  // Post-process steps the importer is run with unless options::import_flags
+  // says otherwise.
+  static const unsigned int default_import_flags =
+      aiProcess_RemoveRedundantMaterials | aiProcess_FindInvalidData |
+      aiProcess_ValidateDataStructure | aiProcess_JoinIdenticalVertices |
+      aiProcess_FindDegenerates | aiProcess_Triangulate;
+  //| aiProcess_SortByPType);
 
-    lemon::ListDigraph _graph;
-    lemon::ListDigraph::NodeMap<std::array<float, 3>> _translation, _scale;
-    lemon::ListDigraph::NodeMap<std::array<float, 4>> _rotation;
-    lemon::ListDigraph::NodeMap<std::string> _name;
+  // Set from the command line or a config file, see config.hpp.
+  struct options {
+    // Assimp post-process steps and importer properties (AI_CONFIG_*, by
+    // value), see configure_importer.
+    unsigned int import_flags = default_import_flags;
+    std::map<std::string, int> importer_int_properties;
+    std::map<std::string, float> importer_float_properties;
+    output_format format = output_format::JSON;
+    // Reduce animation keys with ozz's AnimationOptimizer before building.
+    bool optimize_animations = false;
+    animation_tolerance anim_tolerance;
+    // Per joint overrides of anim_tolerance, by joint name.
+    std::map<std::string, animation_tolerance> joint_tolerances;
+    // Reorder triangles and vertices of each mesh for the GPU vertex caches,
+    // see vertex_cache.hpp.
+    bool optimize_vertex_cache = true;
+    // LODs generated for every mesh, from most to least detailed.
+    std::vector<lod_level> lods;
+    // Largest skinning difference allowed between collapsed vertices, see
+    // simplify_mesh.
+    float lod_max_skin_delta = 0.25f;
+    // Split skinned meshes into submeshes using at most this many joints
+    // each, see palette.hpp. 0 keeps skeleton wide bone indices.
+    size_t max_palette_size = 0;
+    // Joint boxes leave out the vertices a joint weighs less than this on,
+    // see compute_joint_bounds.
+    float joint_bounds_min_weight = 0.1f;
+    // Merge meshes sharing a material into one set of buffers, with a draw
+    // range per source mesh, see mesh_merge.hpp.
+    bool merge_meshes = false;
+    // Cut the indices of each mesh into meshlets of at most this many
+    // vertices and triangles, with culling bounds, see meshlet.hpp.
+    bool build_meshlets = false;
+    size_t max_meshlet_vertices = 64;
+    size_t max_meshlet_triangles = 124;
+    // Write compact vertex streams (see quantize.hpp). Only affects the
+    // .ozzmesh format.
+    bool quantize = false;
+    // Bake every animation into skinning matrices sampled at this many
+    // frames per second, see skinning_baker.hpp. 0 disables it.
+    float bake_frame_rate = 0.0f;
+    // Store baked matrices as half floats.
+    bool bake_half = false;
+    // Convert only the animations, against the runtime skeleton archive at
+    // skeleton_path, see load_animations.
+    bool animations_only = false;
+    std::string skeleton_path;
+    // Read input files through memory mappings, see mmap_io_system.hpp.
+    bool mmap_input = true;
+    // Threads used for per-mesh work, 0 for one per hardware thread.
+    size_t jobs = 0;
+    // Extract, finish and write meshes a few at a time instead of holding
+    // the whole scene, see README. Does not change the outputs.
+    bool stream_meshes = false;
+    // Where to write the --stats report, see conversion_stats.hpp. Empty
+    // disables it.
+    std::string stats_file;
+    // Conversion cache directory, see conversion_cache.hpp. Empty disables it.
+    std::string cache_dir;
 
-    // For easy access
-    std::map<aiNode *, lemon::ListDigraph::Node> nodes;
+    // Only options that change the outputs are archived, since this is what
+    // keys the conversion cache.
+    template <class Archive> void serialize(Archive &archive) {
+      archive(CEREAL_NVP(import_flags), CEREAL_NVP(importer_int_properties),
+              CEREAL_NVP(importer_float_properties), CEREAL_NVP(format),
+              CEREAL_NVP(optimize_animations),
+              CEREAL_NVP(anim_tolerance), CEREAL_NVP(joint_tolerances),
+              CEREAL_NVP(quantize), CEREAL_NVP(optimize_vertex_cache),
+              CEREAL_NVP(lods), CEREAL_NVP(lod_max_skin_delta),
+              CEREAL_NVP(max_palette_size), CEREAL_NVP(merge_meshes),
+              CEREAL_NVP(joint_bounds_min_weight),
+              CEREAL_NVP(build_meshlets), CEREAL_NVP(max_meshlet_vertices),
+              CEREAL_NVP(max_meshlet_triangles),
+              CEREAL_NVP(bake_frame_rate), CEREAL_NVP(bake_half),
+              CEREAL_NVP(animations_only), CEREAL_NVP(skeleton_path));
+    }
   };
 
+  // Applies the importer properties of `opts` and installs an
+  // mmap_io_system, which records the files read from then on. Scenes are
+  // then read with import_flags_for(opts).
+  static void configure_importer(Assimp::Importer &importer,
+                                 const options &opts);
+
+  // opts.import_flags, or none when converting animations only since every
+  // post-process step works on meshes.
+  static unsigned int import_flags_for(const options &opts);
+
+  // Reads a runtime skeleton archive, ie runtime-skeleton.ozz.
+  static bool read_skeleton(const std::string &path,
+                            ozz::animation::Skeleton &skeleton);
+
+  loader() {}
+
+  explicit loader(const options &opts) : opts(opts) {}
+
+  // Converts `scene`, writing every output to `sink`. `name` only labels
+  // logs and stats.
+  bool load(const aiScene *scene, const std::string &name, output_sink &sink);
+
+  // Converts the animations of `scene` only, mapping their channels to the
+  // joints of `skeleton` by name. Meshes, materials and the skeleton
+  // archives are not extracted or written, nor are skinning bakes since
+  // they need the meshes' inverse bind matrices. Channels matching no joint
+  // are reported. load() calls this with the skeleton at
+  // opts.skeleton_path when opts.animations_only is set.
+  bool load_animations(const aiScene *scene, const std::string &name,
+                       const ozz::animation::Skeleton &skeleton,
+                       output_sink &sink);
+
+  // Writes the outputs to output_path_for(name), see get_written_files.
   bool load(const aiScene *scene, const std::string &name);
 
+  // Imports a file held in memory with `importer`, configured from the
+  // options, and converts it. `hint` is the extension of the file format,
+  // ie "fbx".
+  bool load_memory(Assimp::Importer &importer, const void *data, size_t size,
+                   const std::string &hint, const std::string &name,
+                   output_sink &sink);
+
   std::string get_output_path() const { return output_pathname; }
 
+  // Directory load() writes the outputs of `name` to.
+  static std::string output_path_for(const std::string &name) {
+    return "./output/" + name;
+  }
+
+  // Every file written by the last load() to the output directory.
+  const std::vector<std::string> &get_written_files() const {
+    return written_files;
+  }
+
+  // Time spent in each stage of the last load().
+  const std::vector<stage_timing> &get_stage_timings() const {
+    return timings.get();
+  }
+
+  // Counts and timings of the last load(), complete once it succeeded.
+  conversion_stats get_stats() const {
+    conversion_stats s = stats;
+    s.stages = timings.get();
+    return s;
+  }
+
 protected:
+  // Copies vertices, faces and bone weights of one aiMesh. Only touches
+  // temp_mesh, so it can run concurrently for different meshes.
+  static void extract_mesh(const aiMesh *mesh_data, SerializedMesh &temp_mesh);
+
+  // Offset matrices of the bones of every mesh, in joint order. A joint
+  // bound by several meshes keeps the first matrix found; the meshes that
+  // disagree with it are reported and keep their own in assign_joints.
+  static std::vector<std::array<float, 16>> merge_inverse_bind_matrices(
+      const aiScene *scene,
+      const std::unordered_map<std::string, size_t> &joint_indices);
+
+  // Maps the mesh's bone indices and inverse bind matrices to joints of the
+  // skeleton, then splits it by palette if enabled.
+  bool assign_joints(
+      SerializedMesh &mesh,
+      const std::unordered_map<std::string, size_t> &joint_indices,
+      const std::vector<std::string> &joint_names,
+      const std::vector<std::array<float, 16>> &inverse_bind_matrices) const;
+
+  // Converts every animation of `scene` concurrently, adding their timings
+  // and stats, and sets `motions` to the largest motion of each skinned
+  // meshlet over all of them.
+  bool convert_animations(
+      const aiScene *scene,
+      const std::unordered_map<std::string, size_t> &joint_indices,
+      const ozz::animation::Skeleton &skeleton,
+      const ozz::vector<ozz::math::Float4x4> &inverse_bind_matrices,
+      const std::vector<skinned_meshlet> &skinned_meshlets,
+      output_sink &sink, std::vector<meshlet_motion> &motions);
+
+  // Total time and peak memory of a successful load, started at
+  // `load_sample`.
+  void finish_stats(const stage_sample &load_sample);
+
+  // Extracts, optimizes, builds and bakes one animation, and queues its
+  // archives on `writer`. Also measures how far it moves `skinned_meshlets`
+  // into `meshlet_motions`. Only reads shared state, so animations can be
+  // converted concurrently.
+  bool convert_animation(
+      const aiAnimation *anim, size_t anim_num, size_t num_anims,
+      const std::unordered_map<std::string, size_t> &joint_indices,
+      const ozz::animation::Skeleton &skeleton,
+      const ozz::vector<ozz::math::Float4x4> &inverse_bind_matrices,
+      const std::vector<skinned_meshlet> &skinned_meshlets,
+      async_writer &writer, stage_timings &anim_timings,
+      animation_stats &anim_stats,
+      std::vector<meshlet_motion> &meshlet_motions) const;
+
+  options opts;
   std::vector<loader::SerializedMesh> meshes;
   std::vector<loader::SerializedMaterial> materials;
   std::string output_pathname;
+  std::vector<std::string> written_files;
+  stage_timings timings;
+  conversion_stats stats;
 };
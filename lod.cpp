@@ -0,0 +1,306 @@
+#include "lod.hpp"
+#include "bounds.hpp"
+#include "log.hpp"
+#include "vertex_cache.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+namespace {
+
+// Sum of squared distances to a set of planes, weighted by triangle area.
+struct quadric {
+  // Upper triangle of the symmetric 4x4 matrix.
+  double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+  double a11 = 0, a12 = 0, a13 = 0;
+  double a22 = 0, a23 = 0;
+  double a33 = 0;
+  double weight = 0;
+
+  void add_plane(double nx, double ny, double nz, double d, double w) {
+    a00 += w * nx * nx;
+    a01 += w * nx * ny;
+    a02 += w * nx * nz;
+    a03 += w * nx * d;
+    a11 += w * ny * ny;
+    a12 += w * ny * nz;
+    a13 += w * ny * d;
+    a22 += w * nz * nz;
+    a23 += w * nz * d;
+    a33 += w * d * d;
+    weight += w;
+  }
+
+  quadric &operator+=(const quadric &q) {
+    a00 += q.a00;
+    a01 += q.a01;
+    a02 += q.a02;
+    a03 += q.a03;
+    a11 += q.a11;
+    a12 += q.a12;
+    a13 += q.a13;
+    a22 += q.a22;
+    a23 += q.a23;
+    a33 += q.a33;
+    weight += q.weight;
+    return *this;
+  }
+
+  // Mean squared distance of p to the planes.
+  double error(const std::array<float, 3> &p) const {
+    const double x = p[0], y = p[1], z = p[2];
+    const double e = a00 * x * x + a11 * y * y + a22 * z * z + a33 +
+                     2 * (a01 * x * y + a02 * x * z + a12 * y * z + a03 * x +
+                          a13 * y + a23 * z);
+    return weight > 0 ? std::max(e, 0.0) / weight : 0.0;
+  }
+};
+
+std::array<float, 3> triangle_normal(const std::array<float, 3> &p0,
+                                     const std::array<float, 3> &p1,
+                                     const std::array<float, 3> &p2) {
+  const float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+  const float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+  return {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2],
+          e1[0] * e2[1] - e1[1] * e2[0]};
+}
+
+float skin_delta(const loader::SerializedMesh &mesh, uint32_t a, uint32_t b) {
+  if (mesh.bone_weights.empty()) {
+    return 0.0f;
+  }
+  const std::array<uint32_t, 4> &bones_a = mesh.bone_indices[a];
+  const std::array<uint32_t, 4> &bones_b = mesh.bone_indices[b];
+  const std::array<float, 4> &weights_a = mesh.bone_weights[a];
+  const std::array<float, 4> &weights_b = mesh.bone_weights[b];
+  float delta = 0.0f;
+  for (size_t i = 0; i < 4; ++i) {
+    if (weights_a[i] == 0.0f) {
+      continue;
+    }
+    float other = 0.0f;
+    for (size_t j = 0; j < 4; ++j) {
+      if (weights_b[j] != 0.0f && bones_b[j] == bones_a[i]) {
+        other = weights_b[j];
+      }
+    }
+    delta += std::fabs(weights_a[i] - other);
+  }
+  for (size_t j = 0; j < 4; ++j) {
+    if (weights_b[j] == 0.0f) {
+      continue;
+    }
+    bool shared = false;
+    for (size_t i = 0; i < 4; ++i) {
+      shared = shared || (weights_a[i] != 0.0f && bones_a[i] == bones_b[j]);
+    }
+    if (!shared) {
+      delta += weights_b[j];
+    }
+  }
+  return delta * 0.5f;
+}
+
+struct collapse {
+  uint32_t from, to;
+  double cost;
+};
+
+} // namespace
+
+float simplify_mesh(const loader::SerializedMesh &mesh,
+                    size_t target_index_count, float max_error,
+                    float max_skin_delta, std::vector<uint32_t> &indices) {
+  const size_t num_verts = mesh.positions.size();
+  indices = mesh.indices;
+
+  std::vector<quadric> quadrics(num_verts);
+  for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+    const std::array<float, 3> n =
+        triangle_normal(mesh.positions[indices[t]],
+                        mesh.positions[indices[t + 1]],
+                        mesh.positions[indices[t + 2]]);
+    const double length =
+        std::sqrt(double(n[0]) * n[0] + double(n[1]) * n[1] +
+                  double(n[2]) * n[2]);
+    if (length == 0) {
+      continue;
+    }
+    const double nx = n[0] / length, ny = n[1] / length, nz = n[2] / length;
+    const std::array<float, 3> &p = mesh.positions[indices[t]];
+    const double d = -(nx * p[0] + ny * p[1] + nz * p[2]);
+    const double area = length * 0.5;
+    for (size_t k = 0; k < 3; ++k) {
+      quadrics[indices[t + k]].add_plane(nx, ny, nz, d, area);
+    }
+  }
+
+  // Vertices on edges used by a single triangle are borders or seams.
+  std::vector<bool> locked(num_verts, false);
+  {
+    std::unordered_map<uint64_t, uint32_t> edges;
+    for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+      for (size_t k = 0; k < 3; ++k) {
+        const uint32_t a = indices[t + k], b = indices[t + (k + 1) % 3];
+        edges[(uint64_t(std::min(a, b)) << 32) | std::max(a, b)]++;
+      }
+    }
+    for (const std::pair<const uint64_t, uint32_t> &e : edges) {
+      if (e.second == 1) {
+        locked[e.first >> 32] = true;
+        locked[e.first & 0xffffffff] = true;
+      }
+    }
+  }
+
+  const double max_cost = double(max_error) * max_error;
+  double reached = 0.0;
+  std::vector<uint32_t> offsets(num_verts + 1), adjacency;
+  std::vector<collapse> candidates;
+  std::vector<bool> touched(num_verts);
+
+  while (indices.size() > target_index_count) {
+    // Triangles around each vertex.
+    std::fill(offsets.begin(), offsets.end(), 0);
+    for (uint32_t index : indices) {
+      offsets[index + 1]++;
+    }
+    for (size_t v = 0; v < num_verts; ++v) {
+      offsets[v + 1] += offsets[v];
+    }
+    adjacency.resize(indices.size());
+    {
+      std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+      for (size_t i = 0; i < indices.size(); ++i) {
+        adjacency[cursor[indices[i]]++] = static_cast<uint32_t>(i / 3);
+      }
+    }
+
+    candidates.clear();
+    for (size_t t = 0; t < indices.size(); t += 3) {
+      for (size_t k = 0; k < 3; ++k) {
+        const uint32_t a = indices[t + k], b = indices[t + (k + 1) % 3];
+        const uint32_t pair[2][2] = {{a, b}, {b, a}};
+        for (const uint32_t(&c)[2] : pair) {
+          if (locked[c[0]] || skin_delta(mesh, c[0], c[1]) > max_skin_delta) {
+            continue;
+          }
+          quadric q = quadrics[c[0]];
+          q += quadrics[c[1]];
+          const double cost = q.error(mesh.positions[c[1]]);
+          if (cost <= max_cost) {
+            candidates.push_back(collapse{c[0], c[1], cost});
+          }
+        }
+      }
+    }
+    if (candidates.empty()) {
+      break;
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const collapse &a, const collapse &b) {
+                return a.cost < b.cost;
+              });
+
+    // Collapses are independent within a pass: once a vertex moves, its
+    // neighbourhood waits for the next pass.
+    std::fill(touched.begin(), touched.end(), false);
+    std::vector<uint32_t> remap(num_verts);
+    for (size_t v = 0; v < num_verts; ++v) {
+      remap[v] = static_cast<uint32_t>(v);
+    }
+    const size_t tris_to_remove = (indices.size() - target_index_count) / 3;
+    size_t removed = 0;
+    for (const collapse &c : candidates) {
+      if (removed >= tris_to_remove) {
+        break;
+      }
+      if (touched[c.from] || touched[c.to]) {
+        continue;
+      }
+      // Rejects collapses that flip a remaining triangle around `from`.
+      bool flips = false;
+      size_t shared = 0;
+      for (uint32_t a = offsets[c.from]; a < offsets[c.from + 1] && !flips;
+           ++a) {
+        const uint32_t *tri = &indices[adjacency[a] * 3];
+        if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to) {
+          shared++;
+          continue;
+        }
+        std::array<std::array<float, 3>, 3> p;
+        for (size_t k = 0; k < 3; ++k) {
+          p[k] = mesh.positions[tri[k]];
+        }
+        const std::array<float, 3> before = triangle_normal(p[0], p[1], p[2]);
+        for (size_t k = 0; k < 3; ++k) {
+          if (tri[k] == c.from) {
+            p[k] = mesh.positions[c.to];
+          }
+        }
+        const std::array<float, 3> after = triangle_normal(p[0], p[1], p[2]);
+        flips = before[0] * after[0] + before[1] * after[1] +
+                    before[2] * after[2] <=
+                0.0f;
+      }
+      if (flips) {
+        continue;
+      }
+      remap[c.from] = c.to;
+      quadrics[c.to] += quadrics[c.from];
+      reached = std::max(reached, c.cost);
+      removed += shared;
+      for (uint32_t a = offsets[c.from]; a < offsets[c.from + 1]; ++a) {
+        const uint32_t *tri = &indices[adjacency[a] * 3];
+        for (size_t k = 0; k < 3; ++k) {
+          touched[tri[k]] = true;
+        }
+      }
+    }
+    if (removed == 0) {
+      break;
+    }
+
+    size_t write = 0;
+    for (size_t t = 0; t < indices.size(); t += 3) {
+      const uint32_t a = remap[indices[t]], b = remap[indices[t + 1]],
+                     c = remap[indices[t + 2]];
+      if (a != b && b != c && a != c) {
+        indices[write++] = a;
+        indices[write++] = b;
+        indices[write++] = c;
+      }
+    }
+    indices.resize(write);
+  }
+  return static_cast<float>(std::sqrt(reached));
+}
+
+void generate_lods(loader::SerializedMesh &mesh, const loader::options &opts) {
+  mesh.lods.clear();
+  const std::array<float, 3> dimensions = bounds_dimensions(mesh.bounds);
+  const float extent =
+      std::max(dimensions[0], std::max(dimensions[1], dimensions[2]));
+
+  for (const loader::lod_level &level : opts.lods) {
+    const size_t target =
+        static_cast<size_t>(mesh.indices.size() / 3 * level.ratio) * 3;
+    loader::SerializedLod lod;
+    lod.error = simplify_mesh(mesh, target, level.max_error * extent,
+                              opts.lod_max_skin_delta, lod.indices);
+    lod.relative_error = extent > 0.0f ? lod.error / extent : 0.0f;
+    optimize_vertex_cache(lod.indices, mesh.positions.size());
+    mesh.lods.push_back(std::move(lod));
+  }
+}
+
+void print_lods(const loader::SerializedMesh &mesh) {
+  for (size_t i = 0; i < mesh.lods.size(); ++i) {
+    const loader::SerializedLod &lod = mesh.lods[i];
+    LOG(INFO) << "LOD" << i + 1 << " of " << mesh.name << ": "
+              << lod.indices.size() / 3 << " of " << mesh.indices.size() / 3
+              << " triangles, error " << lod.error << " ("
+              << lod.relative_error << " of the mesh size).";
+  }
+}
@@ -0,0 +1,29 @@
+// Level of detail index buffers, simplified from a mesh's own index buffer
+// so that every LOD shares the vertices of LOD0.
+
+#pragma once
+
+#include "loader.hpp"
+
+// Decimates `mesh.indices` down to `target_index_count` indices, or until
+// collapsing any more edges would move the surface by more than `max_error`
+// (model units), whichever comes first.
+//
+// Edges are collapsed onto one of their vertices (quadric error metric), so
+// no vertex is created. Vertices on open edges, which includes UV and
+// normal seams, stay in place. A vertex only collapses onto one whose bone
+// weights differ by at most `max_skin_delta` (half the L1 distance between
+// the two weight sets: 0 for identical skinning, 1 for disjoint bones), so
+// that the simplified surface still deforms like the original.
+//
+// Returns the largest error of the collapses made, in model units.
+float simplify_mesh(const loader::SerializedMesh &mesh,
+                    size_t target_index_count, float max_error,
+                    float max_skin_delta, std::vector<uint32_t> &indices);
+
+// Fills mesh.lods from opts.lods, each level simplified from LOD0 and
+// reordered for the vertex cache. Errors are stored in model units and
+// relative to the largest dimension of mesh.bounds.
+void generate_lods(loader::SerializedMesh &mesh, const loader::options &opts);
+
+void print_lods(const loader::SerializedMesh &mesh);
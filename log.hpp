@@ -0,0 +1,78 @@
+// Leveled logging. Only errors and warnings are printed unless the level is
+// raised (see --log-level), and disabled messages are not even formatted:
+//   LOG(INFO) << "Mesh " << name << " has " << count << " verts.";
+
+#pragma once
+
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+enum class log_level { kError = 0, kWarning = 1, kInfo = 2, kDebug = 3 };
+
+// The names LOG takes. They are pasted rather than expanded, so that ERROR
+// or DEBUG macros (from build flags or system headers) cannot break them.
+static const log_level log_level_ERROR = log_level::kError;
+static const log_level log_level_WARNING = log_level::kWarning;
+static const log_level log_level_INFO = log_level::kInfo;
+static const log_level log_level_DEBUG = log_level::kDebug;
+
+inline std::atomic<int> &current_log_level() {
+  static std::atomic<int> level(static_cast<int>(log_level::kWarning));
+  return level;
+}
+
+inline void set_log_level(log_level level) {
+  current_log_level() = static_cast<int>(level);
+}
+
+inline bool log_enabled(log_level level) {
+  return static_cast<int>(level) <= current_log_level();
+}
+
+// Accepts error, warning, info and debug.
+inline bool parse_log_level(const std::string &name, log_level &level) {
+  const char *names[] = {"error", "warning", "info", "debug"};
+  for (int i = 0; i < 4; ++i) {
+    if (name == names[i]) {
+      level = static_cast<log_level>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+// One message, printed as a single line when destroyed so that messages of
+// concurrent conversions never interleave.
+class log_line {
+public:
+  explicit log_line(log_level level) : level(level) {}
+
+  ~log_line() {
+    static std::mutex mutex;
+    static const char *prefixes[] = {"ERROR: ", "WARNING: ", "", ""};
+    buffer << '\n';
+    std::lock_guard<std::mutex> lock(mutex);
+    std::cout << prefixes[static_cast<int>(level)] << buffer.str()
+              << std::flush;
+  }
+
+  std::ostream &stream() { return buffer; }
+
+private:
+  log_level level;
+  std::ostringstream buffer;
+};
+
+// Gives the streaming expression of LOG the type void, so that it fits the
+// conditional operator.
+struct log_voidify {
+  void operator&(std::ostream &) {}
+};
+
+#define LOG(level)                                                             \
+  !log_enabled(log_level_##level)                                              \
+      ? (void)0                                                                \
+      : log_voidify() & log_line(log_level_##level).stream()
@@ -1,21 +1,38 @@
+#include "batch.hpp"
+#include "config.hpp"
 #include "loader.hpp"
+#include "log.hpp"
 
 int main(int argc, char** argv)
 {
-	if (argc != 2)
+	settings s;
+	if (!parse_command_line(argc, argv, s) || !finish_settings(s))
 	{
-		std::cout << "Usage: mesh_importer <filename>" << std::endl;
+		print_usage();
 		return -1;
 	}
-	Assimp::Importer importer;
-	const aiScene* scene = importer.ReadFile(argv[1],aiProcess_RemoveRedundantMaterials | aiProcess_FindInvalidData | aiProcess_ValidateDataStructure |aiProcess_JoinIdenticalVertices | aiProcess_FindDegenerates | aiProcess_Triangulate);//| aiProcess_SortByPType);
-	loader _loader;
+	const loader::options& opts = s.opts;
 
-	bool success = _loader.load(scene, argv[1]);
+	if (!s.batch_source.empty())
+	{
+		return run_batch(s.batch_source, opts) ? 0 : -2;
+	}
+	const std::string& filename = s.filename;
+	Assimp::Importer importer;
+	batch_result result;
+	convert_file(importer, filename, filename, opts, result);
 
-	if (!success)
+	if (result.cached)
+	{
+		LOG(INFO) << "Outputs of " << filename << " restored from the cache.";
+	}
+	if (!opts.stats_file.empty())
+	{
+		write_stats_report(opts.stats_file, std::vector<conversion_stats>(1, result.stats));
+	}
+	if (!result.success)
 	{
-		std::cout << "Import failed! :(" << std::endl;
+		LOG(ERROR) << "Import failed! :( " << result.error;
 		return -2;
 	}
 	return 0;
@@ -0,0 +1,19 @@
+#include "memory_stats.hpp"
+
+namespace {
+// Plain integers, so they need no construction on new threads.
+thread_local size_t thread_allocation_count = 0;
+thread_local size_t thread_allocated_bytes = 0;
+} // namespace
+
+allocation_counts thread_allocations() {
+  allocation_counts counts;
+  counts.count = thread_allocation_count;
+  counts.bytes = thread_allocated_bytes;
+  return counts;
+}
+
+void record_allocation(size_t bytes) {
+  thread_allocation_count++;
+  thread_allocated_bytes += bytes;
+}
@@ -0,0 +1,30 @@
+// Process memory figures, for the reports printed by conversions.
+
+#pragma once
+
+#include <cstddef>
+#include <sys/resource.h>
+
+// Largest resident set size of the process so far, in bytes.
+inline size_t peak_rss_bytes() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  // Linux reports kilobytes.
+  return static_cast<size_t>(usage.ru_maxrss) * 1024;
+}
+
+struct allocation_counts {
+  size_t count = 0;
+  size_t bytes = 0;
+};
+
+// Allocations made through operator new by the calling thread so far, as
+// counted by the replacement operators of allocation_hooks.cpp. Always zero
+// in programs that do not link it. Allocators that bypass operator new, like
+// ozz's, are not seen.
+allocation_counts thread_allocations();
+
+// Counts an allocation of the calling thread, see allocation_hooks.cpp.
+void record_allocation(size_t bytes);
@@ -0,0 +1,162 @@
+#include "mesh_merge.hpp"
+#include "bounds.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+
+namespace {
+
+bool can_merge(const loader::SerializedMesh &a,
+               const loader::SerializedMesh &b) {
+  return a.material_index == b.material_index &&
+         a.normals.empty() == b.normals.empty() &&
+         a.uvs.empty() == b.uvs.empty() &&
+         a.bone_indices.empty() == b.bone_indices.empty() &&
+         a.lods.size() == b.lods.size() &&
+         a.submeshes.empty() == b.submeshes.empty() &&
+         a.bone_names == b.bone_names &&
+         a.inverse_bind_matrices == b.inverse_bind_matrices;
+}
+
+template <typename T>
+void append(std::vector<T> &to, const std::vector<T> &from) {
+  to.insert(to.end(), from.begin(), from.end());
+}
+
+// Appends `from` to `to` as a range based at `vertex_offset`, and the
+// submeshes offset to the appended indices. The indices themselves stay
+// relative to the range, so that each one picks its own index width.
+void append_indices(std::vector<uint32_t> &to,
+                    std::vector<loader::SerializedSubmesh> &to_submeshes,
+                    std::vector<loader::SerializedRange> &to_ranges,
+                    const std::vector<uint32_t> &from,
+                    const std::vector<loader::SerializedSubmesh> &submeshes,
+                    const std::string &name, uint32_t vertex_offset,
+                    uint32_t vertex_count) {
+  const uint32_t index_offset = static_cast<uint32_t>(to.size());
+  to.insert(to.end(), from.begin(), from.end());
+  for (loader::SerializedSubmesh s : submeshes) {
+    s.index_offset += index_offset;
+    to_submeshes.push_back(std::move(s));
+  }
+  loader::SerializedRange range;
+  range.name = name;
+  range.index_offset = index_offset;
+  range.index_count = static_cast<uint32_t>(from.size());
+  range.vertex_offset = vertex_offset;
+  range.vertex_count = vertex_count;
+  range.short_indices = vertex_count <= 65536;
+  to_ranges.push_back(std::move(range));
+}
+
+loader::SerializedMesh
+merge_group(std::vector<loader::SerializedMesh> &group,
+            const std::vector<loader::SerializedMaterial> &materials) {
+  loader::SerializedMesh merged;
+  const loader::SerializedMesh &first = group.front();
+  const uint32_t material = first.material_index;
+  merged.name = material < materials.size() && !materials[material].name.empty()
+                    ? materials[material].name
+                    : "material-" + std::to_string(material);
+  merged.translation = first.translation;
+  merged.scale = first.scale;
+  merged.rotation = first.rotation;
+  merged.material_index = material;
+  merged.bone_names = first.bone_names;
+  merged.inverse_bind_matrices = first.inverse_bind_matrices;
+  merged.joint_bounds.assign(first.joint_bounds.size(), empty_bounds());
+  merged.lods.resize(first.lods.size());
+  for (loader::SerializedLod &lod : merged.lods) {
+    lod.error = 0.0f;
+  }
+
+  for (loader::SerializedMesh &m : group) {
+    const uint32_t vertex_offset =
+        static_cast<uint32_t>(merged.positions.size());
+    const uint32_t vertex_count = static_cast<uint32_t>(m.positions.size());
+    for (loader::SerializedMeshlet meshlet : m.meshlets) {
+      meshlet.index_offset += static_cast<uint32_t>(merged.indices.size());
+      merged.meshlets.push_back(meshlet);
+    }
+    append(merged.positions, m.positions);
+    append(merged.normals, m.normals);
+    append(merged.uvs, m.uvs);
+    append(merged.bone_indices, m.bone_indices);
+    append(merged.bone_weights, m.bone_weights);
+    for (size_t j = 0; j < m.joint_bounds.size(); ++j) {
+      grow_bounds(merged.joint_bounds[j], m.joint_bounds[j]);
+    }
+    append_indices(merged.indices, merged.submeshes, merged.ranges, m.indices,
+                   m.submeshes, m.name, vertex_offset, vertex_count);
+    for (size_t l = 0; l < m.lods.size(); ++l) {
+      loader::SerializedLod &lod = merged.lods[l];
+      append_indices(lod.indices, lod.submeshes, lod.ranges,
+                     m.lods[l].indices, m.lods[l].submeshes, m.name,
+                     vertex_offset, vertex_count);
+      lod.error = std::max(lod.error, m.lods[l].error);
+    }
+    // Frees each source as soon as it is copied.
+    m = loader::SerializedMesh();
+  }
+
+  merged.bounds = compute_bounds(merged.positions);
+  merged.dimensions = bounds_dimensions(merged.bounds);
+  const float extent = *std::max_element(merged.dimensions.begin(),
+                                         merged.dimensions.end());
+  for (loader::SerializedLod &lod : merged.lods) {
+    lod.relative_error = extent > 0.0f ? lod.error / extent : 0.0f;
+  }
+  return merged;
+}
+
+} // namespace
+
+uint32_t base_vertex(const std::vector<loader::SerializedRange> &ranges,
+                     uint32_t index_offset) {
+  for (const loader::SerializedRange &r : ranges) {
+    if (index_offset >= r.index_offset &&
+        index_offset < r.index_offset + r.index_count) {
+      return r.vertex_offset;
+    }
+  }
+  return 0;
+}
+
+void merge_meshes(std::vector<loader::SerializedMesh> &meshes,
+                  const std::vector<loader::SerializedMaterial> &materials,
+                  merge_report &report) {
+  report.meshes_in = meshes.size();
+  std::vector<std::vector<loader::SerializedMesh>> groups;
+  for (loader::SerializedMesh &m : meshes) {
+    auto it = std::find_if(
+        groups.begin(), groups.end(),
+        [&m](const std::vector<loader::SerializedMesh> &group) {
+          return can_merge(group.front(), m);
+        });
+    if (it == groups.end()) {
+      groups.emplace_back();
+      it = groups.end() - 1;
+    }
+    it->push_back(std::move(m));
+  }
+
+  meshes.clear();
+  for (std::vector<loader::SerializedMesh> &group : groups) {
+    if (group.size() == 1) {
+      meshes.push_back(std::move(group.front()));
+    } else {
+      meshes.push_back(merge_group(group, materials));
+    }
+    for (const loader::SerializedRange &r : meshes.back().ranges) {
+      report.long_index_ranges += !r.short_indices;
+    }
+    group.clear();
+  }
+  report.meshes_out = meshes.size();
+}
+
+void print_merge_report(const merge_report &report) {
+  LOG(INFO) << "Merged " << report.meshes_in << " meshes into "
+            << report.meshes_out << ", " << report.long_index_ranges
+            << " ranges with 32-bit indices.";
+}
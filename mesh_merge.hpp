@@ -0,0 +1,37 @@
+// Concatenates meshes drawn with the same material into one set of vertex
+// and index buffers, so that an asset split into many pieces costs one
+// buffer set and one draw per material.
+
+#pragma once
+
+#include "loader.hpp"
+
+struct merge_report {
+  size_t meshes_in = 0;
+  size_t meshes_out = 0;
+  // Ranges over more than 65536 vertices, whose indices need 32 bits.
+  size_t long_index_ranges = 0;
+};
+
+// Replaces `meshes` by one mesh per group of meshes sharing a material, the
+// same vertex streams (normals, uvs, skinning) and, when skinned, the same
+// inverse bind matrices. Groups keep the order of their first mesh, and a
+// group of one is left as is. The indices, LODs and palette submeshes of a
+// merged mesh are those of its sources in order, and `ranges` tell where
+// each source is. Indices are kept relative to the range holding them, see
+// base_vertex, so that ranges of at most 65536 vertices can be stored with
+// 16 bits even in large merged meshes. Meshlets and submeshes are offset to
+// the merged indices. Merged meshes are named after their material.
+//
+// Must run once bone_indices refer to skeleton joints (or palettes) and LODs
+// are built, since both are per source mesh.
+void merge_meshes(std::vector<loader::SerializedMesh> &meshes,
+                  const std::vector<loader::SerializedMaterial> &materials,
+                  merge_report &report);
+
+void print_merge_report(const merge_report &report);
+
+// Vertex that the index at `index_offset` is relative to: the vertex_offset
+// of the range holding it, or 0 in meshes without ranges.
+uint32_t base_vertex(const std::vector<loader::SerializedRange> &ranges,
+                     uint32_t index_offset);
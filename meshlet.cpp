@@ -0,0 +1,283 @@
+#include "meshlet.hpp"
+#include "log.hpp"
+#include "mesh_merge.hpp"
+#include "skinning_baker.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Normal cones wider than acos(kMinConeDot) cull too rarely to be worth a
+// test.
+const float kMinConeDot = 0.1f;
+
+typedef std::array<float, 3> vec3;
+
+vec3 sub(const vec3 &a, const vec3 &b) {
+  return {{a[0] - b[0], a[1] - b[1], a[2] - b[2]}};
+}
+
+float dot(const vec3 &a, const vec3 &b) {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+vec3 cross(const vec3 &a, const vec3 &b) {
+  return {{a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2],
+           a[0] * b[1] - a[1] * b[0]}};
+}
+
+float length(const vec3 &a) { return std::sqrt(dot(a, a)); }
+
+void compute_bounds(const loader::SerializedMesh &mesh,
+                    loader::SerializedMeshlet &meshlet) {
+  const uint32_t *indices = &mesh.indices[meshlet.index_offset];
+  const vec3 *positions =
+      &mesh.positions[base_vertex(mesh.ranges, meshlet.index_offset)];
+  vec3 min_extents = positions[indices[0]];
+  vec3 max_extents = min_extents;
+  for (uint32_t i = 0; i < meshlet.index_count; ++i) {
+    const vec3 &p = positions[indices[i]];
+    for (size_t k = 0; k < 3; ++k) {
+      min_extents[k] = std::min(min_extents[k], p[k]);
+      max_extents[k] = std::max(max_extents[k], p[k]);
+    }
+  }
+  for (size_t k = 0; k < 3; ++k) {
+    meshlet.center[k] = 0.5f * (min_extents[k] + max_extents[k]);
+  }
+  meshlet.radius = 0.0f;
+  for (uint32_t i = 0; i < meshlet.index_count; ++i) {
+    meshlet.radius = std::max(
+        meshlet.radius,
+        length(sub(positions[indices[i]], meshlet.center)));
+  }
+
+  // The cone holds the face normals, degenerate triangles aside.
+  std::vector<vec3> normals;
+  vec3 axis = {{0.0f, 0.0f, 0.0f}};
+  for (uint32_t i = 0; i < meshlet.index_count; i += 3) {
+    const vec3 &a = positions[indices[i]];
+    const vec3 n = cross(sub(positions[indices[i + 1]], a),
+                         sub(positions[indices[i + 2]], a));
+    const float len = length(n);
+    if (len > 0.0f) {
+      normals.push_back({{n[0] / len, n[1] / len, n[2] / len}});
+      for (size_t k = 0; k < 3; ++k) {
+        axis[k] += normals.back()[k];
+      }
+    }
+  }
+  const float axis_length = length(axis);
+  meshlet.cone_axis = {{0.0f, 0.0f, 1.0f}};
+  meshlet.cone_cutoff = 1.0f;
+  if (axis_length <= 0.0f) {
+    return;
+  }
+  for (size_t k = 0; k < 3; ++k) {
+    axis[k] /= axis_length;
+  }
+  float min_dot = 1.0f;
+  for (const vec3 &n : normals) {
+    min_dot = std::min(min_dot, dot(n, axis));
+  }
+  meshlet.cone_axis = axis;
+  if (min_dot > kMinConeDot) {
+    // Sine of the cone's half angle: past it, every face points away.
+    meshlet.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+  }
+}
+
+} // namespace
+
+void build_meshlets(loader::SerializedMesh &mesh, size_t max_vertices,
+                    size_t max_triangles, meshlet_report &report) {
+  report.name = mesh.name;
+  mesh.meshlets.clear();
+  max_vertices = std::max<size_t>(max_vertices, 3);
+  max_triangles = std::max<size_t>(max_triangles, 1);
+
+  // Meshlets end where submeshes and ranges do, so that each lies in one.
+  std::vector<uint32_t> ends;
+  for (const loader::SerializedSubmesh &s : mesh.submeshes) {
+    ends.push_back(s.index_offset + s.index_count);
+  }
+  for (const loader::SerializedRange &r : mesh.ranges) {
+    ends.push_back(r.index_offset + r.index_count);
+  }
+  ends.push_back(static_cast<uint32_t>(mesh.indices.size()));
+  std::sort(ends.begin(), ends.end());
+
+  // Meshlet each vertex was last added to, offset by one.
+  std::vector<uint32_t> added(mesh.positions.size(), 0);
+  loader::SerializedMeshlet current = {};
+  auto close = [&]() {
+    if (current.index_count > 0) {
+      compute_bounds(mesh, current);
+      mesh.meshlets.push_back(current);
+      report.vertices += current.vertex_count;
+      report.triangles += current.index_count / 3;
+      report.cones += current.cone_cutoff < 1.0f;
+    }
+    current = loader::SerializedMeshlet();
+  };
+  size_t end = 0;
+  // Indices of merged meshes are relative to their range.
+  uint32_t base = base_vertex(mesh.ranges, 0);
+  for (uint32_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+    while (ends[end] <= i) {
+      ++end;
+      close();
+      current.index_offset = i;
+      base = base_vertex(mesh.ranges, i);
+    }
+    uint32_t id = static_cast<uint32_t>(mesh.meshlets.size()) + 1;
+    size_t new_vertices = 0;
+    for (size_t k = 0; k < 3; ++k) {
+      new_vertices += added[base + mesh.indices[i + k]] != id;
+    }
+    if (current.vertex_count + new_vertices > max_vertices ||
+        current.index_count / 3 >= max_triangles) {
+      close();
+      current.index_offset = i;
+      id = static_cast<uint32_t>(mesh.meshlets.size()) + 1;
+    }
+    for (size_t k = 0; k < 3; ++k) {
+      uint32_t &stamp = added[base + mesh.indices[i + k]];
+      if (stamp != id) {
+        stamp = id;
+        ++current.vertex_count;
+      }
+    }
+    current.index_count += 3;
+  }
+  close();
+  report.meshlets = mesh.meshlets.size();
+}
+
+void print_meshlet_report(const meshlet_report &report) {
+  if (report.meshlets == 0) {
+    return;
+  }
+  LOG(INFO) << "Meshlets of " << report.name << ": " << report.meshlets
+            << ", " << report.vertices / report.meshlets << " vertices and "
+            << report.triangles / report.meshlets
+            << " triangles on average, " << report.cones
+            << " with a normal cone.";
+}
+
+std::vector<skinned_meshlet>
+collect_skinned_meshlets(const std::vector<loader::SerializedMesh> &meshes) {
+  std::vector<skinned_meshlet> skinned;
+  for (size_t m = 0; m < meshes.size(); ++m) {
+    const loader::SerializedMesh &mesh = meshes[m];
+    if (mesh.bone_weights.empty()) {
+      continue;
+    }
+    size_t submesh = 0;
+    for (size_t i = 0; i < mesh.meshlets.size(); ++i) {
+      const loader::SerializedMeshlet &meshlet = mesh.meshlets[i];
+      // Palette submeshes and meshlets both follow the index order.
+      while (submesh < mesh.submeshes.size() &&
+             mesh.submeshes[submesh].index_offset +
+                     mesh.submeshes[submesh].index_count <=
+                 meshlet.index_offset) {
+        ++submesh;
+      }
+      const std::vector<uint32_t> *palette =
+          submesh < mesh.submeshes.size() ? &mesh.submeshes[submesh].palette
+                                          : nullptr;
+      const uint32_t base = base_vertex(mesh.ranges, meshlet.index_offset);
+      std::vector<uint32_t> joints;
+      for (uint32_t k = 0; k < meshlet.index_count; ++k) {
+        const uint32_t v = base + mesh.indices[meshlet.index_offset + k];
+        for (size_t w = 0; w < 4; ++w) {
+          if (mesh.bone_weights[v][w] > 0.0f) {
+            const uint32_t bone = mesh.bone_indices[v][w];
+            joints.push_back(palette ? (*palette)[bone] : bone);
+          }
+        }
+      }
+      std::sort(joints.begin(), joints.end());
+      joints.erase(std::unique(joints.begin(), joints.end()), joints.end());
+
+      skinned_meshlet s;
+      s.mesh = m;
+      s.meshlet = i;
+      s.center = meshlet.center;
+      for (uint32_t j : joints) {
+        // Column-major, element (r, c) at c * 4 + r.
+        const std::array<float, 16> &ib = mesh.inverse_bind_matrices[j];
+        skinned_meshlet::joint joint;
+        joint.index = j;
+        for (size_t r = 0; r < 3; ++r) {
+          joint.center[r] = ib[12 + r];
+          for (size_t c = 0; c < 3; ++c) {
+            joint.center[r] += ib[c * 4 + r] * s.center[c];
+            joint.rotation[r * 3 + c] = ib[c * 4 + r];
+          }
+        }
+        s.joints.push_back(joint);
+      }
+      skinned.push_back(std::move(s));
+    }
+  }
+  return skinned;
+}
+
+bool measure_meshlet_motion(const ozz::animation::Animation &animation,
+                            const ozz::animation::Skeleton &skeleton,
+                            const std::vector<skinned_meshlet> &meshlets,
+                            std::vector<meshlet_motion> &motions) {
+  // Baking with identity inverse binds gives the model space joints.
+  const ozz::vector<ozz::math::Float4x4> identities(
+      skeleton.num_joints(), ozz::math::Float4x4::identity());
+  baked_skinning models;
+  if (!bake_skinning(animation, skeleton, identities,
+                     kMeshletMotionFrameRate, models)) {
+    return false;
+  }
+  motions.resize(meshlets.size());
+  for (size_t f = 0; f < models.frame_count; ++f) {
+    const float *frame = &models.matrices[f * models.joint_count * 12];
+    for (size_t i = 0; i < meshlets.size(); ++i) {
+      const skinned_meshlet &meshlet = meshlets[i];
+      meshlet_motion &motion = motions[i];
+      for (const skinned_meshlet::joint &joint : meshlet.joints) {
+        // Rows of the joint's 3x4 model matrix.
+        const float *m = frame + joint.index * 12;
+        vec3 moved;
+        float trace = 0.0f;
+        for (size_t r = 0; r < 3; ++r) {
+          moved[r] = m[r * 4 + 3];
+          for (size_t c = 0; c < 3; ++c) {
+            moved[r] += m[r * 4 + c] * joint.center[c];
+            trace += m[r * 4 + c] * joint.rotation[c * 3 + r];
+          }
+        }
+        motion.displacement = std::max(
+            motion.displacement, length(sub(moved, meshlet.center)));
+        // Angle of the skinning rotation, from its trace.
+        const float cosine =
+            std::min(std::max(0.5f * (trace - 1.0f), -1.0f), 1.0f);
+        motion.angle = std::max(motion.angle, std::acos(cosine));
+      }
+    }
+  }
+  return true;
+}
+
+void expand_skinned_meshlets(std::vector<loader::SerializedMesh> &meshes,
+                             const std::vector<skinned_meshlet> &meshlets,
+                             const std::vector<meshlet_motion> &motions) {
+  const float max_angle = std::acos(kMinConeDot);
+  for (size_t i = 0; i < meshlets.size() && i < motions.size(); ++i) {
+    loader::SerializedMeshlet &meshlet =
+        meshes[meshlets[i].mesh].meshlets[meshlets[i].meshlet];
+    meshlet.radius += motions[i].displacement;
+    if (meshlet.cone_cutoff < 1.0f) {
+      const float angle = std::asin(meshlet.cone_cutoff) + motions[i].angle;
+      meshlet.cone_cutoff = angle < max_angle ? std::sin(angle) : 1.0f;
+    }
+  }
+}
@@ -0,0 +1,73 @@
+// Cuts the index buffer of each mesh into meshlets, small clusters with a
+// bounding sphere and a normal cone, so that engines can frustum, occlusion
+// and backface cull clusters without computing bounds at load time.
+
+#pragma once
+
+#include "loader.hpp"
+
+#include <ozz/animation/runtime/animation.h>
+
+struct meshlet_report {
+  std::string name;
+  size_t meshlets = 0;
+  size_t vertices = 0;  // Sum of the distinct vertices of the meshlets.
+  size_t triangles = 0;
+  size_t cones = 0; // Meshlets that can be backface culled.
+};
+
+// Frames per second animations are sampled at to bound skinned meshlets.
+static const float kMeshletMotionFrameRate = 30.0f;
+
+// Cuts mesh.indices into consecutive meshlets of at most `max_vertices`
+// distinct vertices and `max_triangles` triangles, never across a submesh or
+// range, and computes their bounds in bind pose. Triangles keep their order:
+// after the vertex cache optimization, consecutive triangles are close, and
+// each meshlet stays a plain index range to draw. LODs get no meshlets.
+//
+// Must run after palettes are partitioned, which reorders triangles.
+void build_meshlets(loader::SerializedMesh &mesh, size_t max_vertices,
+                    size_t max_triangles, meshlet_report &report);
+
+void print_meshlet_report(const meshlet_report &report);
+
+// A meshlet of a skinned mesh and the joints it is weighted to, with its
+// center in the bind space of each joint so that animated joints move it
+// cheaply.
+struct skinned_meshlet {
+  struct joint {
+    uint32_t index;
+    std::array<float, 3> center;  // Inverse bind matrix * meshlet center.
+    std::array<float, 9> rotation; // Of the inverse bind matrix, row-major.
+  };
+  size_t mesh;
+  size_t meshlet;
+  std::array<float, 3> center;
+  std::vector<joint> joints;
+};
+
+// How far animations take a skinned meshlet from its bind pose.
+struct meshlet_motion {
+  float displacement = 0.0f; // Of its center, in model units.
+  float angle = 0.0f;        // Largest joint rotation, in radians.
+};
+
+// Every meshlet of the skinned meshes of `meshes`, which must have their
+// meshlets and skeleton joint bone indices.
+std::vector<skinned_meshlet>
+collect_skinned_meshlets(const std::vector<loader::SerializedMesh> &meshes);
+
+// Samples `animation` kMeshletMotionFrameRate times per second and grows
+// `motions`, one per skinned meshlet, to the largest motion seen.
+bool measure_meshlet_motion(const ozz::animation::Animation &animation,
+                            const ozz::animation::Skeleton &skeleton,
+                            const std::vector<skinned_meshlet> &meshlets,
+                            std::vector<meshlet_motion> &motions);
+
+// Grows the bounds of the skinned meshlets so that they hold in every
+// sampled pose. Each vertex is a weighted blend of its joints' transforms,
+// so with rigid joints it stays within radius + displacement of the bind
+// pose center, and its normal within the largest joint rotation.
+void expand_skinned_meshlets(std::vector<loader::SerializedMesh> &meshes,
+                             const std::vector<skinned_meshlet> &meshlets,
+                             const std::vector<meshlet_motion> &motions);
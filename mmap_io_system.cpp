@@ -0,0 +1,99 @@
+#include "mmap_io_system.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+mmap_io_stream::~mmap_io_stream() {
+  if (base) {
+    munmap(const_cast<char *>(base), size);
+  }
+}
+
+size_t mmap_io_stream::Read(void *buffer, size_t element_size,
+                            size_t count) {
+  if (element_size == 0 || position >= size) {
+    return 0;
+  }
+  // Like fread, only whole elements are read.
+  const size_t elements = std::min(count, (size - position) / element_size);
+  const size_t bytes = elements * element_size;
+  std::memcpy(buffer, base + position, bytes);
+  position += bytes;
+  return elements;
+}
+
+aiReturn mmap_io_stream::Seek(size_t offset, aiOrigin origin) {
+  size_t target;
+  switch (origin) {
+  case aiOrigin_SET:
+    target = offset;
+    break;
+  case aiOrigin_CUR:
+    target = position + offset;
+    break;
+  case aiOrigin_END:
+    // Assimp passes the distance back from the end.
+    if (offset > size) {
+      return aiReturn_FAILURE;
+    }
+    target = size - offset;
+    break;
+  default:
+    return aiReturn_FAILURE;
+  }
+  if (target > size) {
+    return aiReturn_FAILURE;
+  }
+  position = target;
+  return aiReturn_SUCCESS;
+}
+
+bool mmap_io_system::Exists(const char *file) const {
+  accessed.insert(file);
+  return DefaultIOSystem::Exists(file);
+}
+
+Assimp::IOStream *mmap_io_system::Open(const char *file, const char *mode) {
+  if (std::strchr(mode, 'w') || std::strchr(mode, 'a') ||
+      std::strchr(mode, '+')) {
+    return DefaultIOSystem::Open(file, mode);
+  }
+  accessed.insert(file);
+  if (!map_files) {
+    return DefaultIOSystem::Open(file, mode);
+  }
+  const int fd = ::open(file, O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    ::close(fd);
+    return DefaultIOSystem::Open(file, mode);
+  }
+  const size_t size = static_cast<size_t>(st.st_size);
+  if (size == 0) {
+    ::close(fd);
+    return new mmap_io_stream(nullptr, 0);
+  }
+  void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    return DefaultIOSystem::Open(file, mode);
+  }
+  // Importers mostly read front to back: read ahead aggressively and start
+  // fetching now, which matters most on network filesystems.
+  madvise(mapping, size, MADV_SEQUENTIAL);
+  madvise(mapping, size, MADV_WILLNEED);
+  return new mmap_io_stream(static_cast<const char *>(mapping), size);
+}
+
+std::vector<std::string> mmap_io_system::take_accessed_files() {
+  std::vector<std::string> files(accessed.begin(), accessed.end());
+  accessed.clear();
+  return files;
+}
@@ -0,0 +1,59 @@
+// An Assimp::IOSystem reading through read-only memory mappings instead of
+// stdio. Assimp opens every file of a scene through its IOSystem, so
+// sidecar files like .mtl or .bin are mapped too. Each read is then one
+// copy out of the page cache, with no read() call or stdio buffer in
+// between, and the kernel is told to read ahead of the importer. It also
+// records which files the importer reads, which the conversion cache checks.
+
+#pragma once
+
+#include <assimp/DefaultIOSystem.h>
+#include <assimp/IOStream.hpp>
+#include <cstddef>
+#include <set>
+#include <string>
+#include <vector>
+
+class mmap_io_stream : public Assimp::IOStream {
+public:
+  // Takes ownership of a mapping of `size` bytes at `base`. Empty files have
+  // no mapping, ie base is nullptr.
+  mmap_io_stream(const char *base, size_t size) : base(base), size(size) {}
+  ~mmap_io_stream() override;
+
+  size_t Read(void *buffer, size_t element_size, size_t count) override;
+  size_t Write(const void *, size_t, size_t) override { return 0; }
+  aiReturn Seek(size_t offset, aiOrigin origin) override;
+  size_t Tell() const override { return position; }
+  size_t FileSize() const override { return size; }
+  void Flush() override {}
+
+  const char *data() const { return base; }
+
+protected:
+  const char *base;
+  size_t size;
+  size_t position = 0;
+};
+
+// Maps files opened for reading; anything else, files that cannot be mapped
+// and every file when mapping is off go through Assimp's default stdio
+// streams.
+class mmap_io_system : public Assimp::DefaultIOSystem {
+public:
+  explicit mmap_io_system(bool map_files = true) : map_files(map_files) {}
+
+  bool Exists(const char *file) const override;
+  Assimp::IOStream *Open(const char *file, const char *mode = "rb") override;
+
+  void set_map_files(bool map) { map_files = map; }
+
+  // Every path looked up or opened for reading since the last call, once
+  // each. Files that were looked for but missing count as well: creating
+  // one can change the scene too.
+  std::vector<std::string> take_accessed_files();
+
+protected:
+  bool map_files;
+  mutable std::set<std::string> accessed;
+};
@@ -0,0 +1,113 @@
+#include "model_writer.hpp"
+#include "capnp_writer.hpp"
+#include "log.hpp"
+
+bool model_writer::begin(output_sink &output) {
+  switch (opts.format) {
+  case loader::output_format::JSON:
+    name = "model.json";
+    break;
+  case loader::output_format::CAPNP:
+    name = "model.capnp";
+    break;
+  case loader::output_format::OZZMESH:
+    name = "model.ozzmesh";
+    break;
+  }
+  LOG(INFO) << "Writing model file " << name;
+
+  sink = &output;
+  final_size = 0;
+  stream = sink->open(name);
+  if (!stream) {
+    LOG(ERROR) << "Could not write model file " << name;
+    return false;
+  }
+  if (opts.format == loader::output_format::JSON) {
+    json_buffer.reset(new ozz_streambuf(*stream));
+    json_stream.reset(new std::ostream(json_buffer.get()));
+    // Same document as archiving a whole SerializedModel as "model", opened
+    // by hand so that meshes can be appended one by one.
+    json.reset(new cereal::JSONOutputArchive(*json_stream));
+    json->setNextName("model");
+    json->startNode();
+    json->setNextName("meshes");
+    json->startNode();
+    json->makeArray();
+    return true;
+  }
+  if (opts.format == loader::output_format::OZZMESH) {
+    ozzmesh.reset(new ozzmesh_writer(*stream, opts.quantize));
+    return ozzmesh->begin();
+  }
+  return true;
+}
+
+bool model_writer::add_mesh(loader::SerializedMesh mesh) {
+  switch (opts.format) {
+  case loader::output_format::JSON:
+    (*json)(mesh);
+    return true;
+  case loader::output_format::CAPNP:
+    capnp_model.meshes.push_back(std::move(mesh));
+    return true;
+  case loader::output_format::OZZMESH:
+    if (!ozzmesh->add_mesh(mesh)) {
+      LOG(ERROR) << "Could not write model file " << name;
+      return false;
+    }
+    if (opts.quantize) {
+      print_quantization_report(ozzmesh->get_quantization_reports().back());
+    }
+    return true;
+  }
+  return false;
+}
+
+bool model_writer::finish(
+    const std::vector<loader::SerializedMaterial> &materials) {
+  bool success = true;
+  switch (opts.format) {
+  case loader::output_format::JSON:
+    json->finishNode(); // meshes
+    (*json)(cereal::make_nvp("materials", materials));
+    json->finishNode(); // model
+    // The archive closes the document when destroyed.
+    json.reset();
+    json_stream->flush();
+    success = !json_stream->fail();
+    json_stream.reset();
+    json_buffer.reset();
+    break;
+  case loader::output_format::CAPNP:
+    capnp_model.materials = materials;
+    success = write_capnp_model(capnp_model, *stream);
+    capnp_model = loader::SerializedModel();
+    break;
+  case loader::output_format::OZZMESH:
+    for (const loader::SerializedMaterial &m : materials) {
+      ozzmesh->add_material(m);
+    }
+    success = ozzmesh->finish();
+    break;
+  }
+  ozzmesh.reset();
+  final_size = stream->Size();
+  success = sink->close(stream) && success;
+  stream = nullptr;
+  if (!success) {
+    LOG(ERROR) << "Could not write model file " << name;
+  }
+  return success;
+}
+
+size_t model_writer::bytes_written() {
+  if (!stream) {
+    return final_size;
+  }
+  if (json_stream) {
+    json_stream->flush();
+  }
+  const int position = stream->Tell();
+  return position > 0 ? static_cast<size_t>(position) : 0;
+}
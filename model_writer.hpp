@@ -0,0 +1,49 @@
+// Writes the model file of a conversion one mesh at a time, in the format
+// chosen by loader::options::format.
+
+#pragma once
+
+#include "loader.hpp"
+#include "output_sink.hpp"
+#include "ozzmesh_writer.hpp"
+
+#include <memory>
+#include <ostream>
+#include <ozz/base/io/stream.h>
+
+class model_writer {
+public:
+  explicit model_writer(const loader::options &opts) : opts(opts) {}
+
+  // Opens the model output of `sink`.
+  bool begin(output_sink &sink);
+
+  // Takes the mesh by value so that callers can move it in. JSON and
+  // .ozzmesh write it right away and free it; Cap'n Proto builds a single
+  // message, so its meshes are kept until finish.
+  bool add_mesh(loader::SerializedMesh mesh);
+
+  bool finish(const std::vector<loader::SerializedMaterial> &materials);
+
+  // Name of the model output, ie "model.json".
+  const std::string &get_name() const { return name; }
+
+  // Bytes written to the model output so far.
+  size_t bytes_written();
+
+protected:
+  const loader::options &opts;
+  std::string name;
+  output_sink *sink = nullptr;
+  ozz::io::Stream *stream = nullptr;
+  // Size of the output once finished.
+  size_t final_size = 0;
+
+  std::unique_ptr<ozz_streambuf> json_buffer;
+  std::unique_ptr<std::ostream> json_stream;
+  std::unique_ptr<cereal::JSONOutputArchive> json;
+
+  std::unique_ptr<ozzmesh_writer> ozzmesh;
+
+  loader::SerializedModel capnp_model;
+};
@@ -0,0 +1,161 @@
+#include "output_sink.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <cstring>
+
+bool directory_sink::create() {
+  boost::system::error_code ec;
+  boost::filesystem::create_directories(boost::filesystem::path(path), ec);
+  if (ec) {
+    LOG(ERROR) << "Could not create path: " << path;
+    return false;
+  }
+  return true;
+}
+
+ozz::io::Stream *directory_sink::open(const std::string &name) {
+  const std::string filename = path + "/" + name;
+  std::unique_ptr<file_stream> file(new file_stream(filename.c_str(), "wb"));
+  if (!file->opened()) {
+    LOG(ERROR) << "Could not write " << filename;
+    return nullptr;
+  }
+  opened.push_back(std::make_pair(filename, std::move(file)));
+  return opened.back().second.get();
+}
+
+bool directory_sink::close(ozz::io::Stream *stream) {
+  auto it = std::find_if(
+      opened.begin(), opened.end(),
+      [stream](const std::pair<std::string, std::unique_ptr<file_stream>>
+                   &f) { return f.second.get() == stream; });
+  if (it == opened.end()) {
+    return false;
+  }
+  const bool written = it->second->close();
+  if (written) {
+    files.push_back(it->first);
+  } else {
+    LOG(ERROR) << "Could not completely write " << it->first;
+  }
+  opened.erase(it);
+  return written;
+}
+
+size_t file_stream::Read(void *buffer, size_t size) {
+  return std::fread(buffer, 1, size, file);
+}
+
+size_t file_stream::Write(const void *buffer, size_t size) {
+  return std::fwrite(buffer, 1, size, file);
+}
+
+int file_stream::Seek(int offset, Origin origin) {
+  int whence = SEEK_SET;
+  switch (origin) {
+  case kCurrent:
+    whence = SEEK_CUR;
+    break;
+  case kEnd:
+    whence = SEEK_END;
+    break;
+  case kSet:
+    break;
+  }
+  return std::fseek(file, offset, whence);
+}
+
+int file_stream::Tell() const { return static_cast<int>(std::ftell(file)); }
+
+size_t file_stream::Size() const {
+  const long position = std::ftell(file);
+  if (position < 0 || std::fseek(file, 0, SEEK_END) != 0) {
+    return 0;
+  }
+  const long size = std::ftell(file);
+  std::fseek(file, position, SEEK_SET);
+  return size < 0 ? 0 : static_cast<size_t>(size);
+}
+
+bool file_stream::close() {
+  if (!file) {
+    return true;
+  }
+  const bool flushed = std::fflush(file) == 0 && !std::ferror(file);
+  const bool closed = std::fclose(file) == 0;
+  file = nullptr;
+  return flushed && closed;
+}
+
+size_t buffer_stream::Read(void *buffer, size_t size) {
+  if (position >= bytes.size()) {
+    return 0;
+  }
+  const size_t count = std::min(size, bytes.size() - position);
+  std::memcpy(buffer, bytes.data() + position, count);
+  position += count;
+  return count;
+}
+
+size_t buffer_stream::Write(const void *buffer, size_t size) {
+  if (position + size > bytes.size()) {
+    bytes.resize(position + size);
+  }
+  std::memcpy(bytes.data() + position, buffer, size);
+  position += size;
+  return size;
+}
+
+int buffer_stream::Seek(int offset, Origin origin) {
+  int base = 0;
+  switch (origin) {
+  case kCurrent:
+    base = static_cast<int>(position);
+    break;
+  case kEnd:
+    base = static_cast<int>(bytes.size());
+    break;
+  case kSet:
+    break;
+  }
+  // Like files, seeking past the end is allowed and fills with zeros on the
+  // next write.
+  if (base + offset < 0) {
+    return -1;
+  }
+  position = static_cast<size_t>(base + offset);
+  return 0;
+}
+
+ozz::io::Stream *memory_sink::open(const std::string &name) {
+  std::unique_ptr<buffer_stream> &stream = outputs[name];
+  stream.reset(new buffer_stream());
+  return stream.get();
+}
+
+buffer_stream *memory_sink::find(const std::string &name) const {
+  auto it = outputs.find(name);
+  return it == outputs.end() ? nullptr : it->second.get();
+}
+
+int ozz_streambuf::overflow(int c) {
+  if (sync() != 0) {
+    return traits_type::eof();
+  }
+  if (c != traits_type::eof()) {
+    *pptr() = static_cast<char>(c);
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+int ozz_streambuf::sync() {
+  const size_t size = static_cast<size_t>(pptr() - pbase());
+  if (stream.Write(pbase(), size) != size) {
+    return -1;
+  }
+  setp(buffer, buffer + sizeof(buffer));
+  return 0;
+}
@@ -0,0 +1,138 @@
+// Destinations for the outputs of loader::load. An output is named like the
+// file it would be in the output directory, ie "runtime-skeleton.ozz" or
+// "model.ozzmesh". directory_sink writes files, memory_sink keeps buffers;
+// implement output_sink to hand load() your own ozz::io::Streams.
+
+#pragma once
+
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <ozz/base/io/stream.h>
+#include <streambuf>
+#include <string>
+#include <utility>
+#include <vector>
+
+class output_sink {
+public:
+  virtual ~output_sink() {}
+
+  // Returns an empty stream for the output `name`, replacing any earlier one
+  // of that name, or nullptr if it cannot be created. The stream must be
+  // seekable (the .ozzmesh header is patched last) and stays valid until
+  // closed. Several outputs can be open at once.
+  virtual ozz::io::Stream *open(const std::string &name) = 0;
+
+  // Finishes an output returned by open. Returns false if it could not be
+  // completely written.
+  virtual bool close(ozz::io::Stream *stream) = 0;
+};
+
+// A file stream like ozz::io::File, except that close() says whether every
+// byte reached the file; ozz::io::File drops the errors of the final flush.
+class file_stream : public ozz::io::Stream {
+public:
+  file_stream(const char *filename, const char *mode)
+      : file(std::fopen(filename, mode)) {}
+  ~file_stream() override { close(); }
+
+  file_stream(const file_stream &) = delete;
+  file_stream &operator=(const file_stream &) = delete;
+
+  bool opened() const override { return file != nullptr; }
+  size_t Read(void *buffer, size_t size) override;
+  size_t Write(const void *buffer, size_t size) override;
+  int Seek(int offset, Origin origin) override;
+  int Tell() const override;
+  size_t Size() const override;
+
+  // Flushes and closes the file. Returns false if a write, the flush or the
+  // close failed, ie on a full disk.
+  bool close();
+
+protected:
+  std::FILE *file;
+};
+
+// Writes every output to a file of a directory.
+class directory_sink : public output_sink {
+public:
+  explicit directory_sink(const std::string &path) : path(path) {}
+
+  // Creates the directory and its parents.
+  bool create();
+
+  ozz::io::Stream *open(const std::string &name) override;
+
+  bool close(ozz::io::Stream *stream) override;
+
+  const std::string &get_path() const { return path; }
+
+  // Path of every output completely written so far.
+  const std::vector<std::string> &get_files() const { return files; }
+
+protected:
+  std::string path;
+  std::vector<std::pair<std::string, std::unique_ptr<file_stream>>> opened;
+  std::vector<std::string> files;
+};
+
+// A growable in-memory stream whose bytes stay accessible, unlike
+// ozz::io::MemoryStream's.
+class buffer_stream : public ozz::io::Stream {
+public:
+  bool opened() const override { return true; }
+  size_t Read(void *buffer, size_t size) override;
+  size_t Write(const void *buffer, size_t size) override;
+  int Seek(int offset, Origin origin) override;
+  int Tell() const override { return static_cast<int>(position); }
+  size_t Size() const override { return bytes.size(); }
+
+  const std::vector<char> &data() const { return bytes; }
+
+protected:
+  std::vector<char> bytes;
+  size_t position = 0;
+};
+
+// Keeps every output in memory. Archives are read back by seeking a stream
+// to its start, ie
+//   buffer_stream *s = sink.find("runtime-skeleton.ozz");
+//   s->Seek(0, ozz::io::Stream::kSet);
+//   ozz::io::IArchive archive(s);
+//   archive >> skeleton;
+class memory_sink : public output_sink {
+public:
+  ozz::io::Stream *open(const std::string &name) override;
+
+  bool close(ozz::io::Stream *) override { return true; }
+
+  // The output `name`, or nullptr if none was written.
+  buffer_stream *find(const std::string &name) const;
+
+  const std::map<std::string, std::unique_ptr<buffer_stream>> &
+  get_outputs() const {
+    return outputs;
+  }
+
+protected:
+  std::map<std::string, std::unique_ptr<buffer_stream>> outputs;
+};
+
+// Lets std::ostream based writers, ie cereal's JSON archive, write to an
+// ozz::io::Stream.
+class ozz_streambuf : public std::streambuf {
+public:
+  explicit ozz_streambuf(ozz::io::Stream &stream) : stream(stream) {
+    setp(buffer, buffer + sizeof(buffer));
+  }
+  ~ozz_streambuf() override { sync(); }
+
+protected:
+  int overflow(int c) override;
+  int sync() override;
+
+  ozz::io::Stream &stream;
+  char buffer[4096];
+};
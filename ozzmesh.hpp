@@ -0,0 +1,700 @@
+// The .ozzmesh container: a flat, memory-mappable file holding the mesh
+// streams of a loader::SerializedModel, plus a header-only reader that maps
+// the file and hands out spans straight into it.
+//
+// Layout (little endian):
+//   FileHeader
+//   per mesh, the stream data, each stream aligned to kStreamAlignment
+//   MeshRecord[mesh_count]          at FileHeader::mesh_table_offset
+//   MaterialRecord[material_count]  at FileHeader::material_table_offset
+//   StreamDesc[], StringRef[],
+//   LodRecord[], SubmeshRecord[],
+//   RangeRecord[], MeshletRecord[]  at MeshRecord::*_offset, per mesh
+//   (and the palettes of the submeshes)
+//   string bytes                    at FileHeader::string_table_offset
+//
+// The tables sit after the data so that the writer never has to hold more
+// than one mesh; only the header is patched once everything is written.
+// This header has no dependency on the loader, ozz or Assimp so that
+// engines can include it on its own.
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+
+namespace ozzmesh {
+
+static const char kMagic[8] = {'O', 'Z', 'Z', 'M', 'E', 'S', 'H', '\0'};
+static const uint32_t kVersion = 9;
+
+// Every stream starts on a cache line, which also satisfies 16 byte SIMD
+// loads.
+static const uint64_t kStreamAlignment = 64;
+
+enum StreamSemantic : uint32_t {
+  kPositions = 0,
+  kNormals = 1,
+  kUvs = 2,
+  kBoneIndices = 3,
+  kBoneWeights = 4,
+  // kUInt16 when every vertex of the mesh can be indexed with 16 bits,
+  // kUInt32 otherwise, and kRangeIndices in meshes with ranges. The LODs of
+  // a mesh use the same format.
+  kIndices = 5,
+  kLodIndices = 6, // One per LOD, in LodRecord order.
+  // One column-major 4x4 float matrix per bone name, see
+  // mesh_view::inverse_bind_matrices.
+  kInverseBindMatrices = 7,
+  // Min then max corner of the box of the vertices each joint moves, in its
+  // bind space and bone name order, see mesh_view::joint_bounds.
+  kJointBounds = 8,
+};
+
+enum StreamFormat : uint32_t {
+  kFloat32 = 0,
+  kUInt32 = 1,
+  // Quantized encodings, see loader::options::quantize.
+  kUNorm16 = 2,    // Positions within the mesh bounds, see decode_position.
+  kOctSNorm16 = 3, // Octahedral unit vectors, see decode_octahedral.
+  kHalf = 4,       // IEEE 754 half floats, see half_to_float.
+  kUInt8 = 5,
+  kUNorm8 = 6, // Bone weights, the 4 of a vertex sum to 255.
+  kUInt16 = 7,
+  // Index bytes of a mesh with ranges, each range stored at its own
+  // RangeRecord::index_format; see mesh_view::range_indices.
+  kRangeIndices = 8,
+};
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t mesh_count;
+  uint64_t mesh_table_offset;
+  uint64_t string_table_offset;
+  uint64_t string_table_size;
+  uint64_t file_size;
+  uint32_t material_count;
+  uint32_t reserved;
+  uint64_t material_table_offset;
+};
+static_assert(sizeof(FileHeader) == 64, "FileHeader must stay 64 bytes");
+
+// Offset and size of a string, relative to the string table.
+struct StringRef {
+  uint32_t offset;
+  uint32_t size;
+};
+
+struct StreamDesc {
+  uint32_t semantic;   // StreamSemantic
+  uint32_t format;     // StreamFormat
+  uint32_t components; // Scalars per element, ie 3 for positions.
+  uint32_t stride;     // Bytes per element.
+  uint64_t offset;     // Absolute file offset, kStreamAlignment aligned.
+  uint64_t count;      // Number of elements.
+};
+static_assert(sizeof(StreamDesc) == 32, "StreamDesc must stay 32 bytes");
+
+struct MeshRecord {
+  StringRef name;
+  uint32_t material_index;
+  uint32_t vertex_count;
+  uint32_t index_count;
+  uint32_t stream_count;
+  uint32_t bone_name_count;
+  uint32_t lod_count;
+  float translation[3];
+  float scale[3];
+  float rotation[4];
+  float dimensions[3];
+  // Box of the vertices, in mesh space.
+  float bounds_min[3];
+  float bounds_max[3];
+  // kUNorm16 positions decode to position_offset + q * position_scale.
+  float position_offset[3];
+  float position_scale[3];
+  uint32_t submesh_count;
+  uint64_t streams_offset;    // StreamDesc[stream_count]
+  uint64_t bone_names_offset; // StringRef[bone_name_count]
+  uint64_t lods_offset;       // LodRecord[lod_count]
+  uint64_t submeshes_offset;  // SubmeshRecord[submesh_count]
+  uint32_t range_count;
+  uint32_t meshlet_count;
+  uint64_t ranges_offset;   // RangeRecord[range_count]
+  uint64_t meshlets_offset; // MeshletRecord[meshlet_count]
+};
+static_assert(sizeof(MeshRecord) == 192, "MeshRecord must stay 192 bytes");
+
+// A simplified index buffer over the vertices of the mesh, LOD1 first.
+struct LodRecord {
+  uint32_t stream;      // Index of its kLodIndices stream in the mesh.
+  uint32_t index_count;
+  float error;          // Largest surface deviation, in model units.
+  float relative_error; // error relative to the largest mesh dimension.
+};
+static_assert(sizeof(LodRecord) == 16, "LodRecord must stay 16 bytes");
+
+// A range of an index buffer drawn with its own joint palette. Only present
+// when the mesh was split by palette; its bone indices are then local to the
+// palette of the submesh drawing the vertex.
+struct SubmeshRecord {
+  uint32_t lod;          // 0 for the mesh indices, n for LOD n.
+  uint32_t index_offset; // Within the index buffer of that LOD.
+  uint32_t index_count;
+  uint32_t palette_size;
+  uint64_t palette_offset; // uint32_t[palette_size], skeleton joints.
+};
+static_assert(sizeof(SubmeshRecord) == 24,
+              "SubmeshRecord must stay 24 bytes");
+
+// The part of a merged mesh that came from one source mesh. Only present on
+// meshes merged by material; drawing every range of a LOD draws all of it.
+// Its indices are relative to vertex_offset, the base vertex to draw it
+// with, and 16-bit whenever it has at most 65536 vertices. Index offsets of
+// submeshes and meshlets count indices, each lying within one range.
+struct RangeRecord {
+  StringRef name;        // Of the source mesh.
+  uint32_t lod;          // 0 for the mesh indices, n for LOD n.
+  uint32_t index_offset; // Within the index buffer of that LOD.
+  uint32_t index_count;
+  uint32_t vertex_offset;
+  uint32_t vertex_count;
+  uint32_t index_format; // kUInt16 or kUInt32.
+  // Of its first index, from the start of the index stream of its LOD.
+  // Aligned to the index size.
+  uint64_t index_byte_offset;
+};
+static_assert(sizeof(RangeRecord) == 40, "RangeRecord must stay 40 bytes");
+
+// Consecutive triangles of the mesh indices with their culling bounds, see
+// loader::SerializedMeshlet for the tests. A cone_cutoff of 1 disables the
+// backface test.
+struct MeshletRecord {
+  uint32_t index_offset;
+  uint32_t index_count;
+  uint32_t vertex_count;
+  float center[3];
+  float radius;
+  float cone_axis[3];
+  float cone_cutoff;
+  uint32_t reserved;
+};
+static_assert(sizeof(MeshletRecord) == 48,
+              "MeshletRecord must stay 48 bytes");
+
+struct MaterialRecord {
+  StringRef name;
+  StringRef diffuse_texture_path;
+  StringRef normals_texture_path;
+  StringRef specular_texture_path;
+};
+
+inline float half_to_float(uint16_t h) {
+  const uint32_t sign = uint32_t(h & 0x8000) << 16;
+  const uint32_t exponent = (h >> 10) & 0x1f;
+  const uint32_t mantissa = h & 0x3ff;
+  uint32_t bits;
+  if (exponent == 0) {
+    // Zero or subnormal: mantissa * 2^-24.
+    const float f = float(mantissa) * (1.0f / 16777216.0f);
+    return sign ? -f : f;
+  } else if (exponent == 31) {
+    bits = sign | 0x7f800000 | (mantissa << 13);
+  } else {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  }
+  float f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+inline float snorm16_to_float(int16_t v) {
+  return v < -32767 ? -1.0f : float(v) / 32767.0f;
+}
+
+// Decodes an octahedral encoded unit vector.
+inline void decode_octahedral(const int16_t encoded[2], float out[3]) {
+  float x = snorm16_to_float(encoded[0]);
+  float y = snorm16_to_float(encoded[1]);
+  const float z = 1.0f - (x < 0 ? -x : x) - (y < 0 ? -y : y);
+  if (z < 0) {
+    const float ox = x;
+    x = (1.0f - (y < 0 ? -y : y)) * (ox < 0 ? -1.0f : 1.0f);
+    y = (1.0f - (ox < 0 ? -ox : ox)) * (y < 0 ? -1.0f : 1.0f);
+  }
+  float length = std::sqrt(x * x + y * y + z * z);
+  length = length > 0 ? 1.0f / length : 0.0f;
+  out[0] = x * length;
+  out[1] = y * length;
+  out[2] = z * length;
+}
+
+inline void decode_position(const MeshRecord &record,
+                            const uint16_t encoded[3], float out[3]) {
+  for (int i = 0; i < 3; ++i) {
+    out[i] = record.position_offset[i] + encoded[i] * record.position_scale[i];
+  }
+}
+
+template <typename T> struct span {
+  span() : ptr(nullptr), count(0) {}
+  span(const T *ptr, size_t count) : ptr(ptr), count(count) {}
+  const T *begin() const { return ptr; }
+  const T *end() const { return ptr + count; }
+  const T *data() const { return ptr; }
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  const T &operator[](size_t i) const { return ptr[i]; }
+
+  const T *ptr;
+  size_t count;
+};
+
+class reader;
+
+// A view of one mesh inside a mapped file. Only valid while the reader that
+// produced it stays open.
+class mesh_view {
+public:
+  mesh_view(const reader &owner, const MeshRecord &record)
+      : owner(&owner), record(&record) {}
+
+  const MeshRecord &info() const { return *record; }
+
+  span<const char> name() const;
+
+  uint32_t bone_name_count() const { return record->bone_name_count; }
+
+  uint32_t lod_count() const { return record->lod_count; }
+
+  const LodRecord &lod(uint32_t i) const;
+
+  // Only one of lod_indices and lod_indices16 is non-empty, depending on
+  // the index format of the mesh. Both are empty in meshes with ranges, see
+  // range_indices.
+  span<const uint32_t> lod_indices(uint32_t i) const;
+
+  span<const uint16_t> lod_indices16(uint32_t i) const;
+
+  uint32_t submesh_count() const { return record->submesh_count; }
+
+  const SubmeshRecord &submesh(uint32_t i) const;
+
+  span<const uint32_t> palette(uint32_t submesh) const;
+
+  uint32_t range_count() const { return record->range_count; }
+
+  const RangeRecord &range(uint32_t i) const;
+
+  // Indices of range i, relative to its vertex_offset. Only one of
+  // range_indices and range_indices16 is non-empty, depending on its
+  // index_format.
+  span<const uint32_t> range_indices(uint32_t i) const;
+
+  span<const uint16_t> range_indices16(uint32_t i) const;
+
+  uint32_t meshlet_count() const { return record->meshlet_count; }
+
+  const MeshletRecord &meshlet(uint32_t i) const;
+
+  span<const char> bone_name(uint32_t i) const;
+
+  // Returns the descriptor of the given stream, or nullptr if the mesh does
+  // not have it.
+  const StreamDesc *find(StreamSemantic semantic) const;
+
+  // Typed access to a stream, T being the element type, ie float[3] or
+  // std::array<float, 3> for positions. Returns an empty span if the stream
+  // is missing or if its stride does not match T.
+  template <typename T> span<T> stream(StreamSemantic semantic) const;
+
+  span<const float> positions() const {
+    return scalars<float>(kPositions, kFloat32);
+  }
+  span<const float> normals() const {
+    return scalars<float>(kNormals, kFloat32);
+  }
+  span<const float> uvs() const { return scalars<float>(kUvs, kFloat32); }
+  span<const uint32_t> bone_indices() const {
+    return scalars<uint32_t>(kBoneIndices, kUInt32);
+  }
+  span<const float> bone_weights() const {
+    return scalars<float>(kBoneWeights, kFloat32);
+  }
+  // Only one of indices and indices16 is non-empty, see kIndices. Both are
+  // empty in meshes with ranges, see range_indices.
+  span<const uint32_t> indices() const {
+    return scalars<uint32_t>(kIndices, kUInt32);
+  }
+  span<const uint16_t> indices16() const {
+    return scalars<uint16_t>(kIndices, kUInt16);
+  }
+  // 16 floats per joint, in bone name order: the inverse bind matrix of each
+  // joint, column-major, ready for a SIMD load of each column. Skinning
+  // matrices are then model_space_joint * inverse_bind.
+  span<const float> inverse_bind_matrices() const {
+    return scalars<float>(kInverseBindMatrices, kFloat32);
+  }
+  // 6 floats per joint, in bone name order: the min and max corners of the
+  // box of the vertices the joint moves, in its bind space. Transformed by
+  // the model space joints, they bound the animated mesh. Empty boxes have
+  // min greater than max.
+  span<const float> joint_bounds() const {
+    return scalars<float>(kJointBounds, kFloat32);
+  }
+
+  // Flat scalar view of a stream (xyzxyz...). Returns an empty span if the
+  // stream is missing or not stored as the given format.
+  template <typename T>
+  span<const T> scalars(StreamSemantic semantic, StreamFormat format) const;
+
+private:
+  const reader *owner;
+  const MeshRecord *record;
+};
+
+// Maps an .ozzmesh file read-only. Nothing is copied: every span handed out
+// points into the mapping, so load cost is the page faults of the data that
+// is actually touched.
+class reader {
+public:
+  reader() : base(nullptr), length(0) {}
+  ~reader() { close(); }
+
+  reader(const reader &) = delete;
+  reader &operator=(const reader &) = delete;
+
+  bool open(const char *path) {
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(FileHeader)) {
+      ::close(fd);
+      return false;
+    }
+    void *mapping = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                         MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+      return false;
+    }
+    base = static_cast<const uint8_t *>(mapping);
+    length = static_cast<size_t>(st.st_size);
+    if (!validate()) {
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  void close() {
+    if (base) {
+      munmap(const_cast<uint8_t *>(base), length);
+    }
+    base = nullptr;
+    length = 0;
+  }
+
+  bool is_open() const { return base != nullptr; }
+
+  const FileHeader &header() const {
+    return *reinterpret_cast<const FileHeader *>(base);
+  }
+
+  uint32_t mesh_count() const { return is_open() ? header().mesh_count : 0; }
+
+  mesh_view mesh(uint32_t i) const {
+    return mesh_view(*this, table<MeshRecord>(header().mesh_table_offset)[i]);
+  }
+
+  uint32_t material_count() const {
+    return is_open() ? header().material_count : 0;
+  }
+
+  const MaterialRecord &material(uint32_t i) const {
+    return table<MaterialRecord>(header().material_table_offset)[i];
+  }
+
+  span<const char> string(const StringRef &ref) const {
+    return span<const char>(reinterpret_cast<const char *>(
+                                base + header().string_table_offset +
+                                ref.offset),
+                            ref.size);
+  }
+
+  template <typename T> const T *table(uint64_t offset) const {
+    return reinterpret_cast<const T *>(base + offset);
+  }
+
+  // The index stream of LOD `lod` of a validated mesh, or nullptr.
+  const StreamDesc *index_stream(const MeshRecord &m, uint32_t lod) const {
+    const StreamDesc *streams = table<StreamDesc>(m.streams_offset);
+    if (lod > 0) {
+      return &streams[table<LodRecord>(m.lods_offset)[lod - 1].stream];
+    }
+    for (uint32_t i = 0; i < m.stream_count; ++i) {
+      if (streams[i].semantic == kIndices) {
+        return &streams[i];
+      }
+    }
+    return nullptr;
+  }
+
+private:
+  bool in_bounds(uint64_t offset, uint64_t size) const {
+    return offset <= length && size <= length - offset;
+  }
+
+  bool validate_string(const StringRef &ref) const {
+    return ref.offset <= header().string_table_size &&
+           ref.size <= header().string_table_size - ref.offset;
+  }
+
+  // Checks every offset once at open time so that the accessors can stay
+  // unchecked.
+  bool validate() const {
+    const FileHeader &h = header();
+    if (std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0 ||
+        h.version != kVersion || h.file_size != length ||
+        !in_bounds(h.string_table_offset, h.string_table_size) ||
+        !in_bounds(h.mesh_table_offset,
+                   uint64_t(h.mesh_count) * sizeof(MeshRecord)) ||
+        !in_bounds(h.material_table_offset,
+                   uint64_t(h.material_count) * sizeof(MaterialRecord))) {
+      return false;
+    }
+    const MaterialRecord *materials =
+        table<MaterialRecord>(h.material_table_offset);
+    for (uint32_t i = 0; i < h.material_count; ++i) {
+      if (!validate_string(materials[i].name) ||
+          !validate_string(materials[i].diffuse_texture_path) ||
+          !validate_string(materials[i].normals_texture_path) ||
+          !validate_string(materials[i].specular_texture_path)) {
+        return false;
+      }
+    }
+    const MeshRecord *meshes = table<MeshRecord>(h.mesh_table_offset);
+    for (uint32_t i = 0; i < h.mesh_count; ++i) {
+      const MeshRecord &m = meshes[i];
+      if (!validate_string(m.name) ||
+          !in_bounds(m.streams_offset,
+                     uint64_t(m.stream_count) * sizeof(StreamDesc)) ||
+          !in_bounds(m.bone_names_offset,
+                     uint64_t(m.bone_name_count) * sizeof(StringRef))) {
+        return false;
+      }
+      const StreamDesc *streams = table<StreamDesc>(m.streams_offset);
+      for (uint32_t j = 0; j < m.stream_count; ++j) {
+        const StreamDesc &s = streams[j];
+        if (s.offset % kStreamAlignment != 0 || s.stride == 0 ||
+            s.count > (length / s.stride) ||
+            !in_bounds(s.offset, s.count * s.stride)) {
+          return false;
+        }
+      }
+      if (!in_bounds(m.lods_offset,
+                     uint64_t(m.lod_count) * sizeof(LodRecord))) {
+        return false;
+      }
+      const LodRecord *lods = table<LodRecord>(m.lods_offset);
+      for (uint32_t j = 0; j < m.lod_count; ++j) {
+        if (lods[j].stream >= m.stream_count ||
+            streams[lods[j].stream].semantic != kLodIndices ||
+            (streams[lods[j].stream].format != kUInt32 &&
+             streams[lods[j].stream].format != kUInt16 &&
+             streams[lods[j].stream].format != kRangeIndices)) {
+          return false;
+        }
+      }
+      if (!in_bounds(m.submeshes_offset,
+                     uint64_t(m.submesh_count) * sizeof(SubmeshRecord))) {
+        return false;
+      }
+      const SubmeshRecord *submeshes =
+          table<SubmeshRecord>(m.submeshes_offset);
+      for (uint32_t j = 0; j < m.submesh_count; ++j) {
+        const SubmeshRecord &sub = submeshes[j];
+        const uint64_t index_count =
+            sub.lod == 0 ? m.index_count
+                         : (sub.lod <= m.lod_count
+                                ? lods[sub.lod - 1].index_count
+                                : 0);
+        if (sub.lod > m.lod_count ||
+            uint64_t(sub.index_offset) + sub.index_count > index_count ||
+            !in_bounds(sub.palette_offset,
+                       uint64_t(sub.palette_size) * sizeof(uint32_t))) {
+          return false;
+        }
+      }
+      if (!in_bounds(m.ranges_offset,
+                     uint64_t(m.range_count) * sizeof(RangeRecord))) {
+        return false;
+      }
+      const RangeRecord *ranges = table<RangeRecord>(m.ranges_offset);
+      for (uint32_t j = 0; j < m.range_count; ++j) {
+        const RangeRecord &r = ranges[j];
+        const uint64_t index_count =
+            r.lod == 0 ? m.index_count
+                       : (r.lod <= m.lod_count ? lods[r.lod - 1].index_count
+                                               : 0);
+        if (r.lod > m.lod_count || !validate_string(r.name) ||
+            uint64_t(r.index_offset) + r.index_count > index_count ||
+            uint64_t(r.vertex_offset) + r.vertex_count > m.vertex_count ||
+            (r.index_format != kUInt16 && r.index_format != kUInt32)) {
+          return false;
+        }
+        const StreamDesc *indices = index_stream(m, r.lod);
+        const uint64_t size = r.index_format == kUInt16 ? 2 : 4;
+        if (r.index_count > 0 &&
+            (!indices || indices->format != kRangeIndices ||
+             r.index_byte_offset % size != 0 ||
+             r.index_byte_offset > indices->count ||
+             r.index_count * size > indices->count - r.index_byte_offset)) {
+          return false;
+        }
+      }
+      if (!in_bounds(m.meshlets_offset,
+                     uint64_t(m.meshlet_count) * sizeof(MeshletRecord))) {
+        return false;
+      }
+      const MeshletRecord *meshlets =
+          table<MeshletRecord>(m.meshlets_offset);
+      for (uint32_t j = 0; j < m.meshlet_count; ++j) {
+        if (uint64_t(meshlets[j].index_offset) + meshlets[j].index_count >
+            m.index_count) {
+          return false;
+        }
+      }
+      const StringRef *names = table<StringRef>(m.bone_names_offset);
+      for (uint32_t j = 0; j < m.bone_name_count; ++j) {
+        if (!validate_string(names[j])) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  const uint8_t *base;
+  size_t length;
+};
+
+inline span<const char> mesh_view::name() const {
+  return owner->string(record->name);
+}
+
+inline span<const char> mesh_view::bone_name(uint32_t i) const {
+  return owner->string(
+      owner->table<StringRef>(record->bone_names_offset)[i]);
+}
+
+inline const LodRecord &mesh_view::lod(uint32_t i) const {
+  return owner->table<LodRecord>(record->lods_offset)[i];
+}
+
+inline span<const uint32_t> mesh_view::lod_indices(uint32_t i) const {
+  const StreamDesc &desc =
+      owner->table<StreamDesc>(record->streams_offset)[lod(i).stream];
+  if (desc.format != kUInt32) {
+    return span<const uint32_t>();
+  }
+  return span<const uint32_t>(owner->table<uint32_t>(desc.offset),
+                              desc.count);
+}
+
+inline span<const uint16_t> mesh_view::lod_indices16(uint32_t i) const {
+  const StreamDesc &desc =
+      owner->table<StreamDesc>(record->streams_offset)[lod(i).stream];
+  if (desc.format != kUInt16) {
+    return span<const uint16_t>();
+  }
+  return span<const uint16_t>(owner->table<uint16_t>(desc.offset),
+                              desc.count);
+}
+
+inline const SubmeshRecord &mesh_view::submesh(uint32_t i) const {
+  return owner->table<SubmeshRecord>(record->submeshes_offset)[i];
+}
+
+inline span<const uint32_t> mesh_view::palette(uint32_t i) const {
+  const SubmeshRecord &sub = submesh(i);
+  return span<const uint32_t>(owner->table<uint32_t>(sub.palette_offset),
+                              sub.palette_size);
+}
+
+inline const RangeRecord &mesh_view::range(uint32_t i) const {
+  return owner->table<RangeRecord>(record->ranges_offset)[i];
+}
+
+inline span<const uint32_t> mesh_view::range_indices(uint32_t i) const {
+  const RangeRecord &r = range(i);
+  const StreamDesc *desc = owner->index_stream(*record, r.lod);
+  if (r.index_format != kUInt32 || !desc) {
+    return span<const uint32_t>();
+  }
+  return span<const uint32_t>(
+      owner->table<uint32_t>(desc->offset + r.index_byte_offset),
+      r.index_count);
+}
+
+inline span<const uint16_t> mesh_view::range_indices16(uint32_t i) const {
+  const RangeRecord &r = range(i);
+  const StreamDesc *desc = owner->index_stream(*record, r.lod);
+  if (r.index_format != kUInt16 || !desc) {
+    return span<const uint16_t>();
+  }
+  return span<const uint16_t>(
+      owner->table<uint16_t>(desc->offset + r.index_byte_offset),
+      r.index_count);
+}
+
+inline const MeshletRecord &mesh_view::meshlet(uint32_t i) const {
+  return owner->table<MeshletRecord>(record->meshlets_offset)[i];
+}
+
+inline const StreamDesc *mesh_view::find(StreamSemantic semantic) const {
+  const StreamDesc *streams =
+      owner->table<StreamDesc>(record->streams_offset);
+  for (uint32_t i = 0; i < record->stream_count; ++i) {
+    if (streams[i].semantic == semantic) {
+      return &streams[i];
+    }
+  }
+  return nullptr;
+}
+
+template <typename T>
+span<T> mesh_view::stream(StreamSemantic semantic) const {
+  const StreamDesc *desc = find(semantic);
+  if (!desc || desc->stride != sizeof(T)) {
+    return span<T>();
+  }
+  return span<T>(owner->table<typename std::remove_const<T>::type>(
+                     desc->offset),
+                 static_cast<size_t>(desc->count));
+}
+
+template <typename T>
+span<const T> mesh_view::scalars(StreamSemantic semantic,
+                                 StreamFormat format) const {
+  const StreamDesc *desc = find(semantic);
+  if (!desc || desc->format != format ||
+      desc->stride != desc->components * sizeof(T)) {
+    return span<const T>();
+  }
+  return span<const T>(owner->table<T>(desc->offset),
+                       static_cast<size_t>(desc->count * desc->components));
+}
+
+} // namespace ozzmesh
@@ -0,0 +1,384 @@
+#include "ozzmesh_writer.hpp"
+
+#include <algorithm>
+
+bool ozzmesh_writer::write(const void *data, size_t size) {
+  if (size == 0) {
+    return true;
+  }
+  if (stream.Write(data, size) != size) {
+    return false;
+  }
+  position += size;
+  return true;
+}
+
+bool ozzmesh_writer::pad_to(uint64_t alignment) {
+  static const char zeros[ozzmesh::kStreamAlignment] = {};
+  const uint64_t padding = (alignment - position % alignment) % alignment;
+  return write(zeros, static_cast<size_t>(padding));
+}
+
+template <typename T>
+bool ozzmesh_writer::add_stream(std::vector<ozzmesh::StreamDesc> &streams,
+                                ozzmesh::StreamSemantic semantic,
+                                ozzmesh::StreamFormat format,
+                                uint32_t components,
+                                const std::vector<T> &data) {
+  if (data.empty()) {
+    return true;
+  }
+  if (!pad_to(ozzmesh::kStreamAlignment)) {
+    return false;
+  }
+  ozzmesh::StreamDesc desc;
+  desc.semantic = semantic;
+  desc.format = format;
+  desc.components = components;
+  desc.stride = sizeof(T);
+  desc.offset = position;
+  desc.count = data.size();
+  streams.push_back(desc);
+  return write(data.data(), data.size() * sizeof(T));
+}
+
+ozzmesh::StringRef ozzmesh_writer::add_string(const std::string &s) {
+  ozzmesh::StringRef ref;
+  ref.offset = static_cast<uint32_t>(strings.size());
+  ref.size = static_cast<uint32_t>(s.size());
+  strings += s;
+  // Keeps names usable as C strings straight from the mapping.
+  strings.push_back('\0');
+  return ref;
+}
+
+bool ozzmesh_writer::write_indices(const uint32_t *indices, size_t count,
+                                   bool short_indices) {
+  if (!short_indices) {
+    return write(indices, count * sizeof(uint32_t));
+  }
+  const std::vector<uint16_t> narrow(indices, indices + count);
+  return write(narrow.data(), count * sizeof(uint16_t));
+}
+
+bool ozzmesh_writer::add_index_stream(
+    std::vector<ozzmesh::StreamDesc> &streams,
+    ozzmesh::StreamSemantic semantic, const std::vector<uint32_t> &indices,
+    bool short_indices, uint32_t lod,
+    std::vector<ozzmesh::RangeRecord> &ranges) {
+  if (!pad_to(ozzmesh::kStreamAlignment)) {
+    return false;
+  }
+  ozzmesh::StreamDesc desc;
+  desc.semantic = semantic;
+  desc.components = 1;
+  desc.offset = position;
+  if (ranges.empty()) {
+    desc.format = short_indices ? ozzmesh::kUInt16 : ozzmesh::kUInt32;
+    desc.stride = short_indices ? sizeof(uint16_t) : sizeof(uint32_t);
+    desc.count = indices.size();
+    streams.push_back(desc);
+    return write_indices(indices.data(), indices.size(), short_indices);
+  }
+  // Ranges follow each other in the indices; each is aligned to its own
+  // index size.
+  for (ozzmesh::RangeRecord &r : ranges) {
+    if (r.lod != lod) {
+      continue;
+    }
+    const bool short_range = r.index_format == ozzmesh::kUInt16;
+    if (!pad_to(short_range ? sizeof(uint16_t) : sizeof(uint32_t))) {
+      return false;
+    }
+    r.index_byte_offset = position - desc.offset;
+    if (!write_indices(indices.data() + r.index_offset, r.index_count,
+                       short_range)) {
+      return false;
+    }
+  }
+  desc.format = ozzmesh::kRangeIndices;
+  desc.stride = 1;
+  desc.count = position - desc.offset;
+  streams.push_back(desc);
+  return true;
+}
+
+bool ozzmesh_writer::begin() {
+  ozzmesh::FileHeader header = {};
+  return write(&header, sizeof(header));
+}
+
+bool ozzmesh_writer::add_mesh(const loader::SerializedMesh &mesh) {
+  ozzmesh::MeshRecord record = {};
+  record.name = add_string(mesh.name);
+  record.material_index = mesh.material_index;
+  record.vertex_count = static_cast<uint32_t>(mesh.positions.size());
+  record.index_count = static_cast<uint32_t>(mesh.indices.size());
+  for (size_t i = 0; i < 3; ++i) {
+    record.translation[i] = mesh.translation[i];
+    record.scale[i] = mesh.scale[i];
+    record.dimensions[i] = mesh.dimensions[i];
+    record.bounds_min[i] = mesh.bounds.min[i];
+    record.bounds_max[i] = mesh.bounds.max[i];
+  }
+  for (size_t i = 0; i < 4; ++i) {
+    record.rotation[i] = mesh.rotation[i];
+  }
+
+  for (size_t i = 0; i < 3; ++i) {
+    record.position_offset[i] = 0.0f;
+    record.position_scale[i] = 1.0f;
+  }
+
+  std::vector<ozzmesh::StreamDesc> streams;
+  if (quantize) {
+    if (!add_quantized_streams(mesh, record, streams)) {
+      return false;
+    }
+  } else if (!add_stream(streams, ozzmesh::kPositions, ozzmesh::kFloat32, 3,
+                         mesh.positions) ||
+             !add_stream(streams, ozzmesh::kNormals, ozzmesh::kFloat32, 3,
+                         mesh.normals) ||
+             !add_stream(streams, ozzmesh::kUvs, ozzmesh::kFloat32, 2,
+                         mesh.uvs) ||
+             !add_stream(streams, ozzmesh::kBoneIndices, ozzmesh::kUInt32, 4,
+                         mesh.bone_indices) ||
+             !add_stream(streams, ozzmesh::kBoneWeights, ozzmesh::kFloat32, 4,
+                         mesh.bone_weights)) {
+    return false;
+  }
+  std::vector<ozzmesh::RangeRecord> ranges;
+  for (size_t i = 0; i <= mesh.lods.size(); ++i) {
+    const std::vector<loader::SerializedRange> &source =
+        i == 0 ? mesh.ranges : mesh.lods[i - 1].ranges;
+    for (const loader::SerializedRange &r : source) {
+      ozzmesh::RangeRecord range = {};
+      range.name = add_string(r.name);
+      range.lod = static_cast<uint32_t>(i);
+      range.index_offset = r.index_offset;
+      range.index_count = r.index_count;
+      range.vertex_offset = r.vertex_offset;
+      range.vertex_count = r.vertex_count;
+      range.index_format =
+          r.short_indices ? ozzmesh::kUInt16 : ozzmesh::kUInt32;
+      ranges.push_back(range);
+    }
+  }
+  record.range_count = static_cast<uint32_t>(ranges.size());
+
+  // Halves index bandwidth whenever the vertices fit, ie most meshes. Merged
+  // meshes decide per range instead, see RangeRecord.
+  const bool short_indices = mesh.positions.size() <= 65536;
+  if ((!mesh.indices.empty() &&
+       !add_index_stream(streams, ozzmesh::kIndices, mesh.indices,
+                         short_indices, 0, ranges)) ||
+      !add_stream(streams, ozzmesh::kInverseBindMatrices, ozzmesh::kFloat32,
+                  16, mesh.inverse_bind_matrices) ||
+      !add_stream(streams, ozzmesh::kJointBounds, ozzmesh::kFloat32, 6,
+                  mesh.joint_bounds)) {
+    return false;
+  }
+  std::vector<ozzmesh::LodRecord> lods;
+  for (const loader::SerializedLod &l : mesh.lods) {
+    ozzmesh::LodRecord lod;
+    lod.stream = static_cast<uint32_t>(streams.size());
+    lod.index_count = static_cast<uint32_t>(l.indices.size());
+    lod.error = l.error;
+    lod.relative_error = l.relative_error;
+    // Written even when empty, to keep one stream per LOD.
+    if (!add_index_stream(streams, ozzmesh::kLodIndices, l.indices,
+                          short_indices,
+                          static_cast<uint32_t>(lods.size() + 1), ranges)) {
+      return false;
+    }
+    lods.push_back(lod);
+  }
+  record.stream_count = static_cast<uint32_t>(streams.size());
+  record.lod_count = static_cast<uint32_t>(lods.size());
+
+  std::vector<std::pair<uint32_t, loader::SerializedSubmesh>> submeshes;
+  for (const loader::SerializedSubmesh &s : mesh.submeshes) {
+    submeshes.push_back(std::make_pair(0u, s));
+  }
+  for (size_t i = 0; i < mesh.lods.size(); ++i) {
+    for (const loader::SerializedSubmesh &s : mesh.lods[i].submeshes) {
+      submeshes.push_back(std::make_pair(static_cast<uint32_t>(i + 1), s));
+    }
+  }
+  record.submesh_count = static_cast<uint32_t>(submeshes.size());
+
+  std::vector<ozzmesh::MeshletRecord> meshlets;
+  for (const loader::SerializedMeshlet &m : mesh.meshlets) {
+    ozzmesh::MeshletRecord meshlet = {};
+    meshlet.index_offset = m.index_offset;
+    meshlet.index_count = m.index_count;
+    meshlet.vertex_count = m.vertex_count;
+    std::copy(m.center.begin(), m.center.end(), meshlet.center);
+    meshlet.radius = m.radius;
+    std::copy(m.cone_axis.begin(), m.cone_axis.end(), meshlet.cone_axis);
+    meshlet.cone_cutoff = m.cone_cutoff;
+    meshlets.push_back(meshlet);
+  }
+  record.meshlet_count = static_cast<uint32_t>(meshlets.size());
+
+  std::vector<ozzmesh::StringRef> bone_names;
+  for (const std::string &s : mesh.bone_names) {
+    bone_names.push_back(add_string(s));
+  }
+  record.bone_name_count = static_cast<uint32_t>(bone_names.size());
+
+  records.push_back(record);
+  mesh_streams.push_back(std::move(streams));
+  mesh_bone_names.push_back(std::move(bone_names));
+  mesh_lods.push_back(std::move(lods));
+  mesh_submeshes.push_back(std::move(submeshes));
+  mesh_ranges.push_back(std::move(ranges));
+  mesh_meshlets.push_back(std::move(meshlets));
+  return true;
+}
+
+bool ozzmesh_writer::add_quantized_streams(
+    const loader::SerializedMesh &mesh, ozzmesh::MeshRecord &record,
+    std::vector<ozzmesh::StreamDesc> &streams) {
+  QuantizedMesh quantized;
+  quantization_report report;
+  quantize_mesh(mesh, quantized, report);
+  quantization_reports.push_back(report);
+
+  for (size_t i = 0; i < 3; ++i) {
+    record.position_offset[i] = quantized.position_offset[i];
+    record.position_scale[i] = quantized.position_scale[i];
+  }
+  return add_stream(streams, ozzmesh::kPositions, ozzmesh::kUNorm16, 3,
+                    quantized.positions) &&
+         add_stream(streams, ozzmesh::kNormals, ozzmesh::kOctSNorm16, 2,
+                    quantized.normals) &&
+         add_stream(streams, ozzmesh::kUvs, ozzmesh::kHalf, 2,
+                    quantized.uvs) &&
+         add_stream(streams, ozzmesh::kBoneIndices, ozzmesh::kUInt8, 4,
+                    quantized.bone_indices8) &&
+         add_stream(streams, ozzmesh::kBoneIndices, ozzmesh::kUInt16, 4,
+                    quantized.bone_indices16) &&
+         add_stream(streams, ozzmesh::kBoneWeights, ozzmesh::kUNorm8, 4,
+                    quantized.bone_weights);
+}
+
+void ozzmesh_writer::add_material(
+    const loader::SerializedMaterial &material) {
+  ozzmesh::MaterialRecord record;
+  record.name = add_string(material.name);
+  record.diffuse_texture_path = add_string(material.diffuse_texture_path);
+  record.normals_texture_path = add_string(material.normals_texture_path);
+  record.specular_texture_path = add_string(material.specular_texture_path);
+  material_records.push_back(record);
+}
+
+bool ozzmesh_writer::finish() {
+  // Per mesh tables first, so that the records can point at them.
+  for (size_t i = 0; i < records.size(); ++i) {
+    if (!pad_to(8)) {
+      return false;
+    }
+    records[i].streams_offset = position;
+    if (!write(mesh_streams[i].data(),
+               mesh_streams[i].size() * sizeof(ozzmesh::StreamDesc))) {
+      return false;
+    }
+    records[i].bone_names_offset = position;
+    if (!write(mesh_bone_names[i].data(),
+               mesh_bone_names[i].size() * sizeof(ozzmesh::StringRef))) {
+      return false;
+    }
+    records[i].lods_offset = position;
+    if (!write(mesh_lods[i].data(),
+               mesh_lods[i].size() * sizeof(ozzmesh::LodRecord))) {
+      return false;
+    }
+    std::vector<ozzmesh::SubmeshRecord> submeshes;
+    for (const std::pair<uint32_t, loader::SerializedSubmesh> &s :
+         mesh_submeshes[i]) {
+      ozzmesh::SubmeshRecord submesh;
+      submesh.lod = s.first;
+      submesh.index_offset = s.second.index_offset;
+      submesh.index_count = s.second.index_count;
+      submesh.palette_size = static_cast<uint32_t>(s.second.palette.size());
+      submesh.palette_offset = position;
+      if (!write(s.second.palette.data(),
+                 s.second.palette.size() * sizeof(uint32_t))) {
+        return false;
+      }
+      submeshes.push_back(submesh);
+    }
+    if (!pad_to(8)) {
+      return false;
+    }
+    records[i].submeshes_offset = position;
+    if (!write(submeshes.data(),
+               submeshes.size() * sizeof(ozzmesh::SubmeshRecord))) {
+      return false;
+    }
+    records[i].ranges_offset = position;
+    if (!write(mesh_ranges[i].data(),
+               mesh_ranges[i].size() * sizeof(ozzmesh::RangeRecord))) {
+      return false;
+    }
+    records[i].meshlets_offset = position;
+    if (!write(mesh_meshlets[i].data(),
+               mesh_meshlets[i].size() * sizeof(ozzmesh::MeshletRecord))) {
+      return false;
+    }
+  }
+
+  ozzmesh::FileHeader header = {};
+  std::memcpy(header.magic, ozzmesh::kMagic, sizeof(header.magic));
+  header.version = ozzmesh::kVersion;
+  header.mesh_count = static_cast<uint32_t>(records.size());
+
+  if (!pad_to(8)) {
+    return false;
+  }
+  header.mesh_table_offset = position;
+  if (!write(records.data(), records.size() * sizeof(ozzmesh::MeshRecord))) {
+    return false;
+  }
+  header.material_count = static_cast<uint32_t>(material_records.size());
+  header.material_table_offset = position;
+  if (!write(material_records.data(),
+             material_records.size() * sizeof(ozzmesh::MaterialRecord))) {
+    return false;
+  }
+  header.string_table_offset = position;
+  header.string_table_size = strings.size();
+  if (!write(strings.data(), strings.size())) {
+    return false;
+  }
+  header.file_size = position;
+
+  if (stream.Seek(0, ozz::io::Stream::kSet) != 0) {
+    return false;
+  }
+  return stream.Write(&header, sizeof(header)) == sizeof(header);
+}
+
+bool write_ozzmesh_model(const loader::SerializedModel &model,
+                         ozz::io::Stream &stream, bool quantize) {
+  ozzmesh_writer writer(stream, quantize);
+  if (!writer.begin()) {
+    return false;
+  }
+  for (const loader::SerializedMesh &m : model.meshes) {
+    if (!writer.add_mesh(m)) {
+      return false;
+    }
+  }
+  for (const loader::SerializedMaterial &m : model.materials) {
+    writer.add_material(m);
+  }
+  if (!writer.finish()) {
+    return false;
+  }
+  for (const quantization_report &r : writer.get_quantization_reports()) {
+    print_quantization_report(r);
+  }
+  return true;
+}
@@ -0,0 +1,84 @@
+// Writes loader::SerializedMesh data into the .ozzmesh container described in
+// ozzmesh.hpp.
+
+#pragma once
+
+#include "loader.hpp"
+#include "ozzmesh.hpp"
+#include "quantize.hpp"
+
+class ozzmesh_writer {
+public:
+  // With `quantize`, vertex streams are written in the compact formats of
+  // quantize.hpp instead of 32 bit floats and integers.
+  explicit ozzmesh_writer(ozz::io::Stream &stream, bool quantize = false)
+      : stream(stream), quantize(quantize) {}
+
+  // Reserves the header. Must be called once before add_mesh.
+  bool begin();
+
+  // Writes the streams of a mesh right away; only its table entries are kept
+  // until finish.
+  bool add_mesh(const loader::SerializedMesh &mesh);
+
+  void add_material(const loader::SerializedMaterial &material);
+
+  // Writes the tables and patches the header.
+  bool finish();
+
+  // Errors introduced by quantization, one per mesh added.
+  const std::vector<quantization_report> &get_quantization_reports() const {
+    return quantization_reports;
+  }
+
+protected:
+  bool write(const void *data, size_t size);
+
+  bool pad_to(uint64_t alignment);
+
+  bool write_indices(const uint32_t *indices, size_t count,
+                     bool short_indices);
+
+  // Writes the indices of LOD `lod` (0 for the mesh indices). Meshes without
+  // ranges use the same width throughout; otherwise each range of the LOD
+  // is stored at its own index_format, and its index_byte_offset is set.
+  bool add_index_stream(std::vector<ozzmesh::StreamDesc> &streams,
+                        ozzmesh::StreamSemantic semantic,
+                        const std::vector<uint32_t> &indices,
+                        bool short_indices, uint32_t lod,
+                        std::vector<ozzmesh::RangeRecord> &ranges);
+
+  template <typename T>
+  bool add_stream(std::vector<ozzmesh::StreamDesc> &streams,
+                  ozzmesh::StreamSemantic semantic,
+                  ozzmesh::StreamFormat format, uint32_t components,
+                  const std::vector<T> &data);
+
+  bool add_quantized_streams(const loader::SerializedMesh &mesh,
+                             ozzmesh::MeshRecord &record,
+                             std::vector<ozzmesh::StreamDesc> &streams);
+
+  ozzmesh::StringRef add_string(const std::string &s);
+
+  ozz::io::Stream &stream;
+  bool quantize;
+  // Position tracked here since ozz::io::Stream::Tell is limited to 2GB.
+  uint64_t position = 0;
+
+  std::vector<ozzmesh::MeshRecord> records;
+  std::vector<std::vector<ozzmesh::StreamDesc>> mesh_streams;
+  std::vector<std::vector<ozzmesh::StringRef>> mesh_bone_names;
+  std::vector<std::vector<ozzmesh::LodRecord>> mesh_lods;
+  // Submeshes of each mesh with their LOD, kept until their palettes are
+  // written in finish.
+  std::vector<std::vector<std::pair<uint32_t, loader::SerializedSubmesh>>>
+      mesh_submeshes;
+  std::vector<std::vector<ozzmesh::RangeRecord>> mesh_ranges;
+  std::vector<std::vector<ozzmesh::MeshletRecord>> mesh_meshlets;
+  std::vector<ozzmesh::MaterialRecord> material_records;
+  std::string strings;
+  std::vector<quantization_report> quantization_reports;
+};
+
+bool write_ozzmesh_model(const loader::SerializedModel &model,
+                         ozz::io::Stream &stream, bool quantize = false);
@@ -0,0 +1,177 @@
+#include "palette.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+
+namespace {
+
+// Copy of a vertex at `local` palette indices, shared by every submesh that
+// ends up with the same local indices for it.
+struct vertex_variant {
+  std::array<uint32_t, 4> local;
+  uint32_t index;
+};
+
+class partitioner {
+public:
+  partitioner(loader::SerializedMesh &mesh, size_t max_palette_size,
+              palette_report &report)
+      : mesh(mesh), max_palette_size(max_palette_size), report(report),
+        variants(mesh.positions.size()),
+        skeleton_indices(mesh.bone_indices) {}
+
+  bool run(std::vector<uint32_t> &indices,
+           std::vector<loader::SerializedSubmesh> &submeshes) {
+    const size_t num_tris = indices.size() / 3;
+    std::vector<std::vector<uint32_t>> joints(num_tris);
+    for (size_t t = 0; t < num_tris; ++t) {
+      joints[t] = triangle_joints(&indices[t * 3]);
+      if (joints[t].size() > max_palette_size) {
+        LOG(ERROR) << "A triangle of " << mesh.name << " uses "
+                   << joints[t].size() << " joints, more than the palette size "
+                   << max_palette_size << ".";
+        return false;
+      }
+    }
+
+    // Each pass opens a palette and takes, in order, every remaining
+    // triangle whose joints still fit in it.
+    std::vector<bool> assigned(num_tris, false);
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+    size_t remaining = num_tris;
+    while (remaining > 0) {
+      loader::SerializedSubmesh submesh;
+      submesh.index_offset = static_cast<uint32_t>(output.size());
+      std::vector<uint32_t> &palette = submesh.palette;
+      for (size_t t = 0; t < num_tris; ++t) {
+        if (assigned[t]) {
+          continue;
+        }
+        size_t added = 0;
+        for (uint32_t j : joints[t]) {
+          if (std::find(palette.begin(), palette.end(), j) == palette.end()) {
+            added++;
+          }
+        }
+        if (palette.size() + added > max_palette_size) {
+          continue;
+        }
+        for (uint32_t j : joints[t]) {
+          if (std::find(palette.begin(), palette.end(), j) == palette.end()) {
+            palette.push_back(j);
+          }
+        }
+        for (size_t k = 0; k < 3; ++k) {
+          output.push_back(localize(indices[t * 3 + k], palette));
+        }
+        assigned[t] = true;
+        remaining--;
+      }
+      submesh.index_count =
+          static_cast<uint32_t>(output.size()) - submesh.index_offset;
+      report.submeshes++;
+      report.largest_palette =
+          std::max(report.largest_palette, palette.size());
+      report.joints_used += palette.size();
+      submeshes.push_back(std::move(submesh));
+    }
+    indices.swap(output);
+    return true;
+  }
+
+private:
+  // Skeleton joints a triangle depends on.
+  std::vector<uint32_t> triangle_joints(const uint32_t *tri) const {
+    std::vector<uint32_t> joints;
+    for (size_t k = 0; k < 3; ++k) {
+      for (size_t i = 0; i < 4; ++i) {
+        if (mesh.bone_weights[tri[k]][i] > 0.0f) {
+          joints.push_back(skeleton_indices[tri[k]][i]);
+        }
+      }
+    }
+    std::sort(joints.begin(), joints.end());
+    joints.erase(std::unique(joints.begin(), joints.end()), joints.end());
+    return joints;
+  }
+
+  // Index of a vertex whose bone_indices point into `palette`.
+  uint32_t localize(uint32_t vertex, const std::vector<uint32_t> &palette) {
+    std::array<uint32_t, 4> local = {0, 0, 0, 0};
+    for (size_t i = 0; i < 4; ++i) {
+      if (mesh.bone_weights[vertex][i] > 0.0f) {
+        local[i] = static_cast<uint32_t>(
+            std::find(palette.begin(), palette.end(),
+                      skeleton_indices[vertex][i]) -
+            palette.begin());
+      }
+    }
+    for (const vertex_variant &v : variants[vertex]) {
+      if (v.local == local) {
+        return v.index;
+      }
+    }
+    // The first variant keeps the original slot.
+    uint32_t index = vertex;
+    if (!variants[vertex].empty()) {
+      index = static_cast<uint32_t>(mesh.positions.size());
+      duplicate(vertex);
+      report.duplicated_vertices++;
+    }
+    mesh.bone_indices[index] = local;
+    variants[vertex].push_back(vertex_variant{local, index});
+    return index;
+  }
+
+  void duplicate(uint32_t vertex) {
+    mesh.positions.push_back(mesh.positions[vertex]);
+    if (!mesh.normals.empty()) {
+      mesh.normals.push_back(mesh.normals[vertex]);
+    }
+    if (!mesh.uvs.empty()) {
+      mesh.uvs.push_back(mesh.uvs[vertex]);
+    }
+    mesh.bone_indices.push_back(mesh.bone_indices[vertex]);
+    mesh.bone_weights.push_back(mesh.bone_weights[vertex]);
+  }
+
+  loader::SerializedMesh &mesh;
+  size_t max_palette_size;
+  palette_report &report;
+  std::vector<std::vector<vertex_variant>> variants;
+  // bone_indices before localization, as they get overwritten. Indexed by
+  // original vertex, which is all the index buffers refer to.
+  std::vector<std::array<uint32_t, 4>> skeleton_indices;
+};
+
+} // namespace
+
+bool partition_palettes(loader::SerializedMesh &mesh, size_t max_palette_size,
+                        palette_report &report) {
+  report.name = mesh.name;
+  if (mesh.bone_indices.empty()) {
+    return true;
+  }
+  partitioner p(mesh, max_palette_size, report);
+  if (!p.run(mesh.indices, mesh.submeshes)) {
+    return false;
+  }
+  for (loader::SerializedLod &lod : mesh.lods) {
+    if (!p.run(lod.indices, lod.submeshes)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void print_palette_report(const palette_report &report) {
+  if (report.submeshes == 0) {
+    return;
+  }
+  LOG(INFO) << "Palettes of " << report.name << ": " << report.submeshes
+            << " submeshes, largest palette " << report.largest_palette
+            << " joints, " << report.joints_used / report.submeshes
+            << " on average, " << report.duplicated_vertices
+            << " duplicated vertices.";
+}
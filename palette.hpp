@@ -0,0 +1,28 @@
+// Splits skinned meshes into submeshes whose joint palettes fit a fixed
+// budget, so that a draw only uploads the joints it uses.
+
+#pragma once
+
+#include "loader.hpp"
+
+struct palette_report {
+  std::string name;
+  size_t submeshes = 0;
+  size_t largest_palette = 0;
+  size_t joints_used = 0; // Sum of the palette sizes.
+  size_t duplicated_vertices = 0;
+};
+
+// Groups the triangles of mesh.indices and of every LOD into submeshes that
+// use at most `max_palette_size` joints each. Triangles are reordered so
+// that each submesh is a contiguous index range, keeping their relative
+// order otherwise. bone_indices are rewritten to index the palette of the
+// submesh using the vertex; a vertex needed with different local indices by
+// several submeshes is duplicated at the end of the vertex streams.
+//
+// Must run once bone_indices refer to skeleton joints. Fails if a single
+// triangle needs more joints than the budget.
+bool partition_palettes(loader::SerializedMesh &mesh, size_t max_palette_size,
+                        palette_report &report);
+
+void print_palette_report(const palette_report &report);
@@ -0,0 +1,63 @@
+// Helpers to spread independent work items over several threads.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Number of threads to use for a requested job count, 0 meaning one per
+// hardware thread.
+inline size_t resolve_jobs(size_t jobs) {
+  if (jobs == 0) {
+    jobs = std::thread::hardware_concurrency();
+  }
+  return std::max<size_t>(jobs, 1);
+}
+
+// Calls fn(i) for every i in [0, count) on up to `jobs` threads, the calling
+// thread included. Items are handed out one at a time, so a few expensive
+// items do not stall the others. Callers store results by index, which keeps
+// the output order independent of scheduling. The first exception thrown by
+// fn is rethrown once every thread has stopped.
+template <typename F> void parallel_for(size_t count, size_t jobs, F fn) {
+  jobs = std::min(resolve_jobs(jobs), count);
+  if (jobs <= 1) {
+    for (size_t i = 0; i < count; ++i) {
+      fn(i);
+    }
+    return;
+  }
+
+  std::atomic<size_t> next(0);
+  std::exception_ptr error;
+  std::mutex error_mutex;
+  auto worker = [&]() {
+    try {
+      for (size_t i = next++; i < count; i = next++) {
+        fn(i);
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (!error) {
+        error = std::current_exception();
+      }
+      next = count;
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < jobs; ++t) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (std::thread &t : threads) {
+    t.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
@@ -0,0 +1,27 @@
+// Checked parsing of counts and sizes given as settings or flags.
+
+#pragma once
+
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+// Parses a decimal count. Unlike a bare strtoul, signs, surrounding text and
+// values that do not fit are rejected, so "-1" is an error rather than the
+// largest size.
+inline bool parse_size(const std::string &text, size_t &value) {
+  if (text.empty() || !std::isdigit(static_cast<unsigned char>(text[0]))) {
+    return false;
+  }
+  char *end = nullptr;
+  errno = 0;
+  const unsigned long long parsed = std::strtoull(text.c_str(), &end, 10);
+  if (*end != '\0' || errno == ERANGE ||
+      parsed > static_cast<unsigned long long>(SIZE_MAX)) {
+    return false;
+  }
+  value = static_cast<size_t>(parsed);
+  return true;
+}
@@ -0,0 +1,218 @@
+#include "quantize.hpp"
+#include "log.hpp"
+#include "ozzmesh.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+uint16_t float_to_half(float f) {
+  uint32_t x;
+  std::memcpy(&x, &f, sizeof(x));
+  const uint16_t sign = static_cast<uint16_t>((x >> 16) & 0x8000);
+  uint32_t mantissa = x & 0x7fffff;
+  const int exponent = static_cast<int>((x >> 23) & 0xff);
+
+  if (exponent == 0xff) {
+    // Inf stays inf, NaN stays a (quiet) NaN.
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+  }
+  const int e = exponent - 127 + 15;
+  if (e >= 0x1f) {
+    return sign | 0x7c00;
+  }
+  if (e <= 0) {
+    // Subnormal half, or zero once too small.
+    if (e < -10) {
+      return sign;
+    }
+    mantissa |= 0x800000;
+    const int shift = 14 - e;
+    uint32_t half_mantissa = mantissa >> shift;
+    const uint32_t remainder = mantissa & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if (remainder > halfway || (remainder == halfway && (half_mantissa & 1))) {
+      half_mantissa++;
+    }
+    return static_cast<uint16_t>(sign | half_mantissa);
+  }
+  uint32_t half = sign | (static_cast<uint32_t>(e) << 10) | (mantissa >> 13);
+  const uint32_t remainder = mantissa & 0x1fff;
+  // Round to nearest even; a carry into the exponent is still correct.
+  if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+    half++;
+  }
+  return static_cast<uint16_t>(half);
+}
+
+namespace {
+
+int16_t float_to_snorm16(float v) {
+  v = std::max(-1.0f, std::min(1.0f, v));
+  return static_cast<int16_t>(std::lround(v * 32767.0f));
+}
+
+float sign_not_zero(float v) { return v < 0.0f ? -1.0f : 1.0f; }
+
+} // namespace
+
+void encode_octahedral(const std::array<float, 3> &normal,
+                       std::array<int16_t, 2> &encoded) {
+  const float l1 =
+      std::fabs(normal[0]) + std::fabs(normal[1]) + std::fabs(normal[2]);
+  float x = l1 > 0.0f ? normal[0] / l1 : 0.0f;
+  float y = l1 > 0.0f ? normal[1] / l1 : 0.0f;
+  if (normal[2] < 0.0f) {
+    const float ox = x;
+    x = (1.0f - std::fabs(y)) * sign_not_zero(ox);
+    y = (1.0f - std::fabs(ox)) * sign_not_zero(y);
+  }
+  encoded[0] = float_to_snorm16(x);
+  encoded[1] = float_to_snorm16(y);
+}
+
+void quantize_mesh(const loader::SerializedMesh &mesh, QuantizedMesh &out,
+                   quantization_report &report) {
+  report.name = mesh.name;
+  const size_t num_verts = mesh.positions.size();
+
+  // Positions, relative to the bounds of this mesh.
+  std::array<float, 3> min_extents = {0.0f, 0.0f, 0.0f};
+  std::array<float, 3> max_extents = {0.0f, 0.0f, 0.0f};
+  if (num_verts > 0) {
+    min_extents = max_extents = mesh.positions[0];
+  }
+  for (const std::array<float, 3> &p : mesh.positions) {
+    for (size_t i = 0; i < 3; ++i) {
+      min_extents[i] = std::min(min_extents[i], p[i]);
+      max_extents[i] = std::max(max_extents[i], p[i]);
+    }
+  }
+  for (size_t i = 0; i < 3; ++i) {
+    out.position_offset[i] = min_extents[i];
+    out.position_scale[i] = (max_extents[i] - min_extents[i]) / 65535.0f;
+  }
+  out.positions.resize(num_verts);
+  for (size_t n = 0; n < num_verts; ++n) {
+    float error = 0.0f;
+    for (size_t i = 0; i < 3; ++i) {
+      const float extent = max_extents[i] - min_extents[i];
+      const float t =
+          extent > 0.0f ? (mesh.positions[n][i] - min_extents[i]) / extent
+                        : 0.0f;
+      out.positions[n][i] = static_cast<uint16_t>(
+          std::lround(std::max(0.0f, std::min(1.0f, t)) * 65535.0f));
+      const float decoded =
+          out.position_offset[i] + out.positions[n][i] * out.position_scale[i];
+      error += (decoded - mesh.positions[n][i]) *
+               (decoded - mesh.positions[n][i]);
+    }
+    report.position_error = std::max(report.position_error, std::sqrt(error));
+  }
+
+  // Normals, measured as the angle to the normalized source.
+  out.normals.resize(mesh.normals.size());
+  for (size_t n = 0; n < mesh.normals.size(); ++n) {
+    const std::array<float, 3> &normal = mesh.normals[n];
+    encode_octahedral(normal, out.normals[n]);
+    float decoded[3];
+    ozzmesh::decode_octahedral(out.normals[n].data(), decoded);
+    const float length = std::sqrt(normal[0] * normal[0] +
+                                   normal[1] * normal[1] +
+                                   normal[2] * normal[2]);
+    if (length > 0.0f) {
+      const float cosine = (normal[0] * decoded[0] + normal[1] * decoded[1] +
+                            normal[2] * decoded[2]) /
+                           length;
+      const float degrees = std::acos(std::max(-1.0f, std::min(1.0f, cosine))) *
+                            57.29577951f;
+      report.normal_error = std::max(report.normal_error, degrees);
+    }
+  }
+
+  out.uvs.resize(mesh.uvs.size());
+  for (size_t n = 0; n < mesh.uvs.size(); ++n) {
+    for (size_t i = 0; i < 2; ++i) {
+      out.uvs[n][i] = float_to_half(mesh.uvs[n][i]);
+      report.uv_error =
+          std::max(report.uv_error, std::fabs(ozzmesh::half_to_float(
+                                                  out.uvs[n][i]) -
+                                              mesh.uvs[n][i]));
+    }
+  }
+
+  uint32_t max_joint = 0;
+  for (const std::array<uint32_t, 4> &indices : mesh.bone_indices) {
+    max_joint = std::max(max_joint, *std::max_element(indices.begin(),
+                                                      indices.end()));
+  }
+  if (max_joint < 256) {
+    out.bone_indices8.resize(mesh.bone_indices.size());
+    for (size_t n = 0; n < mesh.bone_indices.size(); ++n) {
+      for (size_t i = 0; i < 4; ++i) {
+        out.bone_indices8[n][i] = static_cast<uint8_t>(mesh.bone_indices[n][i]);
+      }
+    }
+  } else {
+    out.bone_indices16.resize(mesh.bone_indices.size());
+    for (size_t n = 0; n < mesh.bone_indices.size(); ++n) {
+      for (size_t i = 0; i < 4; ++i) {
+        out.bone_indices16[n][i] =
+            static_cast<uint16_t>(mesh.bone_indices[n][i]);
+      }
+    }
+  }
+
+  // Weights are renormalized, then rounded with the largest remainder method
+  // so that the 4 bytes always sum to 255.
+  out.bone_weights.resize(mesh.bone_weights.size());
+  for (size_t n = 0; n < mesh.bone_weights.size(); ++n) {
+    const std::array<float, 4> &w = mesh.bone_weights[n];
+    const float sum = w[0] + w[1] + w[2] + w[3];
+    std::array<uint8_t, 4> &q = out.bone_weights[n];
+    if (sum <= 0.0f) {
+      q = {0, 0, 0, 0};
+      continue;
+    }
+    std::array<float, 4> remainders;
+    int total = 0;
+    for (size_t i = 0; i < 4; ++i) {
+      const float scaled = std::max(0.0f, w[i]) / sum * 255.0f;
+      q[i] = static_cast<uint8_t>(std::floor(scaled));
+      remainders[i] = scaled - q[i];
+      total += q[i];
+    }
+    for (; total < 255; ++total) {
+      const size_t largest =
+          std::max_element(remainders.begin(), remainders.end()) -
+          remainders.begin();
+      q[largest]++;
+      remainders[largest] = -1.0f;
+    }
+    for (size_t i = 0; i < 4; ++i) {
+      report.weight_error =
+          std::max(report.weight_error,
+                   std::fabs(q[i] / 255.0f - std::max(0.0f, w[i]) / sum));
+    }
+  }
+
+  report.bytes_in = mesh.positions.size() * sizeof(mesh.positions[0]) +
+                    mesh.normals.size() * sizeof(mesh.normals[0]) +
+                    mesh.uvs.size() * sizeof(mesh.uvs[0]) +
+                    mesh.bone_indices.size() * sizeof(mesh.bone_indices[0]) +
+                    mesh.bone_weights.size() * sizeof(mesh.bone_weights[0]);
+  report.bytes_out = out.positions.size() * sizeof(out.positions[0]) +
+                     out.normals.size() * sizeof(out.normals[0]) +
+                     out.uvs.size() * sizeof(out.uvs[0]) +
+                     out.bone_indices8.size() * sizeof(out.bone_indices8[0]) +
+                     out.bone_indices16.size() * sizeof(out.bone_indices16[0]) +
+                     out.bone_weights.size() * sizeof(out.bone_weights[0]);
+}
+
+void print_quantization_report(const quantization_report &report) {
+  LOG(INFO) << "Quantized mesh " << report.name << ": " << report.bytes_in
+            << " -> " << report.bytes_out
+            << " vertex bytes. Max errors: position " << report.position_error
+            << ", normal " << report.normal_error << " degrees, uv "
+            << report.uv_error << ", weight " << report.weight_error << ".";
+}
@@ -0,0 +1,44 @@
+// Compact encodings of SerializedMesh vertex attributes, written to the
+// .ozzmesh container when loader::options::quantize is set.
+
+#pragma once
+
+#include "loader.hpp"
+
+struct QuantizedMesh {
+  // Positions as 16 bit fractions of the mesh bounds, decoded as
+  // position_offset + q * position_scale.
+  std::vector<std::array<uint16_t, 3>> positions;
+  std::array<float, 3> position_offset, position_scale;
+  // Octahedral unit vectors, 2 x snorm16.
+  std::vector<std::array<int16_t, 2>> normals;
+  // Half floats.
+  std::vector<std::array<uint16_t, 2>> uvs;
+  // 8 bit joint indices, or 16 bit ones when the mesh references joints past
+  // 255 (only one of the two is filled).
+  std::vector<std::array<uint8_t, 4>> bone_indices8;
+  std::vector<std::array<uint16_t, 4>> bone_indices16;
+  // Weights of a vertex sum to exactly 255.
+  std::vector<std::array<uint8_t, 4>> bone_weights;
+};
+
+// Largest decoding error of each attribute of a mesh.
+struct quantization_report {
+  std::string name;
+  float position_error = 0.0f; // Model units.
+  float normal_error = 0.0f;   // Degrees.
+  float uv_error = 0.0f;
+  float weight_error = 0.0f;
+  size_t bytes_in = 0;
+  size_t bytes_out = 0;
+};
+
+uint16_t float_to_half(float f);
+
+void encode_octahedral(const std::array<float, 3> &normal,
+                       std::array<int16_t, 2> &encoded);
+
+void quantize_mesh(const loader::SerializedMesh &mesh, QuantizedMesh &out,
+                   quantization_report &report);
+
+void print_quantization_report(const quantization_report &report);
@@ -0,0 +1,84 @@
+// The .skinbake format: the skinning matrices of one animation sampled at a
+// fixed rate and laid out as a texture, so that crowds play animations with
+// a texture fetch in the vertex shader instead of sampling on the CPU.
+//
+// Layout (little endian):
+//   FileHeader
+//   `height` rows of `row_bytes` at FileHeader::data_offset, one per frame
+//
+// Row f holds the pose at time f / frame_rate (the last frame is clamped to
+// the duration). For each joint, in the order of the runtime skeleton, it
+// has 3 RGBA texels: the rows of the 3x4 matrix taking a vertex from bind
+// space to model space, ie the joint's model-space transform times its
+// inverse bind matrix. kRGBA16F texels are IEEE 754 half floats, see
+// ozzmesh::half_to_float.
+//
+// Like ozzmesh.hpp, this header has no dependency so that engines can
+// include it on its own.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace skinbake {
+
+static const char kMagic[8] = {'S', 'K', 'I', 'N', 'B', 'A', 'K', 'E'};
+static const uint32_t kVersion = 1;
+
+// The texture data starts on a cache line, rows are packed.
+static const uint64_t kDataAlignment = 64;
+
+static const uint32_t kTexelsPerJoint = 3;
+
+enum TexelFormat : uint32_t {
+  kRGBA32F = 0,
+  kRGBA16F = 1,
+};
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t texel_format;
+  uint32_t joint_count;
+  uint32_t frame_count;
+  float frame_rate; // Frames per second.
+  float duration;   // Seconds.
+  uint32_t width;   // Texels per row, joint_count * kTexelsPerJoint.
+  uint32_t height;  // Rows, frame_count.
+  uint32_t row_bytes;
+  uint32_t reserved;
+  uint64_t data_offset;
+  uint64_t data_size;
+};
+static_assert(sizeof(FileHeader) == 64, "FileHeader must stay 64 bytes");
+
+inline uint32_t texel_bytes(uint32_t format) {
+  return format == kRGBA16F ? 8 : 16;
+}
+
+// Checks the header of `size` bytes at `data` and that the texture fits.
+inline bool validate(const void *data, size_t size) {
+  if (size < sizeof(FileHeader)) {
+    return false;
+  }
+  FileHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion ||
+      (header.texel_format != kRGBA32F && header.texel_format != kRGBA16F)) {
+    return false;
+  }
+  const uint64_t row_bytes =
+      uint64_t(header.joint_count) * kTexelsPerJoint *
+      texel_bytes(header.texel_format);
+  return header.width == header.joint_count * kTexelsPerJoint &&
+         header.height == header.frame_count &&
+         header.row_bytes == row_bytes &&
+         header.data_size == row_bytes * header.height &&
+         header.data_offset % kDataAlignment == 0 &&
+         header.data_offset + header.data_size <= size;
+}
+
+} // namespace skinbake
@@ -0,0 +1,124 @@
+#include "skinning_baker.hpp"
+#include "quantize.hpp"
+#include "skinbake.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <ozz/animation/runtime/local_to_model_job.h>
+#include <ozz/animation/runtime/sampling_job.h>
+
+namespace {
+
+// Rows of the upper 3x4 part of a column-major matrix.
+void store_rows(const ozz::math::Float4x4 &m, float *rows) {
+  float cols[4][4];
+  for (size_t c = 0; c < 4; ++c) {
+    ozz::math::StorePtrU(m.cols[c], cols[c]);
+  }
+  for (size_t r = 0; r < 3; ++r) {
+    for (size_t c = 0; c < 4; ++c) {
+      rows[r * 4 + c] = cols[c][r];
+    }
+  }
+}
+
+} // namespace
+
+ozz::vector<ozz::math::Float4x4> load_inverse_bind_matrices(
+    const std::vector<std::array<float, 16>> &matrices) {
+  ozz::vector<ozz::math::Float4x4> out(matrices.size());
+  for (size_t i = 0; i < matrices.size(); ++i) {
+    for (size_t c = 0; c < 4; ++c) {
+      out[i].cols[c] = ozz::math::simd_float4::LoadPtrU(&matrices[i][c * 4]);
+    }
+  }
+  return out;
+}
+
+bool bake_skinning(
+    const ozz::animation::Animation &animation,
+    const ozz::animation::Skeleton &skeleton,
+    const ozz::vector<ozz::math::Float4x4> &inverse_bind_matrices,
+    float frame_rate, baked_skinning &baked) {
+  const size_t num_joints = skeleton.num_joints();
+  if (frame_rate <= 0.0f || inverse_bind_matrices.size() != num_joints ||
+      animation.num_tracks() != skeleton.num_joints()) {
+    return false;
+  }
+  const float duration = animation.duration();
+  baked.joint_count = num_joints;
+  baked.frame_rate = frame_rate;
+  baked.duration = duration;
+  baked.frame_count =
+      static_cast<size_t>(std::ceil(duration * frame_rate)) + 1;
+  baked.matrices.resize(baked.frame_count * num_joints * 12);
+
+  ozz::animation::SamplingJob::Context context(animation.num_tracks());
+  ozz::vector<ozz::math::SoaTransform> locals(skeleton.num_soa_joints());
+  ozz::vector<ozz::math::Float4x4> models(num_joints);
+
+  ozz::animation::SamplingJob sampling;
+  sampling.animation = &animation;
+  sampling.context = &context;
+  sampling.output = ozz::make_span(locals);
+
+  ozz::animation::LocalToModelJob local_to_model;
+  local_to_model.skeleton = &skeleton;
+  local_to_model.input = ozz::make_span(locals);
+  local_to_model.output = ozz::make_span(models);
+
+  for (size_t f = 0; f < baked.frame_count; ++f) {
+    const float time = std::min(f / frame_rate, duration);
+    sampling.ratio = duration > 0.0f ? time / duration : 0.0f;
+    if (!sampling.Run() || !local_to_model.Run()) {
+      return false;
+    }
+    float *frame = &baked.matrices[f * num_joints * 12];
+    for (size_t j = 0; j < num_joints; ++j) {
+      store_rows(models[j] * inverse_bind_matrices[j], frame + j * 12);
+    }
+  }
+  return true;
+}
+
+bool write_skinbake(const baked_skinning &baked, bool half,
+                    ozz::io::Stream &stream) {
+  const uint32_t format = half ? skinbake::kRGBA16F : skinbake::kRGBA32F;
+  const size_t floats_per_row = baked.joint_count * 12;
+
+  skinbake::FileHeader header = {};
+  std::memcpy(header.magic, skinbake::kMagic, sizeof(header.magic));
+  header.version = skinbake::kVersion;
+  header.texel_format = format;
+  header.joint_count = static_cast<uint32_t>(baked.joint_count);
+  header.frame_count = static_cast<uint32_t>(baked.frame_count);
+  header.frame_rate = baked.frame_rate;
+  header.duration = baked.duration;
+  header.width =
+      static_cast<uint32_t>(baked.joint_count * skinbake::kTexelsPerJoint);
+  header.height = header.frame_count;
+  header.row_bytes = header.width * skinbake::texel_bytes(format);
+  // The header is exactly one alignment unit.
+  header.data_offset = sizeof(header);
+  header.data_size = uint64_t(header.row_bytes) * header.height;
+  if (stream.Write(&header, sizeof(header)) != sizeof(header)) {
+    return false;
+  }
+
+  std::vector<uint16_t> half_row(half ? floats_per_row : 0);
+  for (size_t f = 0; f < baked.frame_count; ++f) {
+    const float *row = &baked.matrices[f * floats_per_row];
+    if (half) {
+      std::transform(row, row + floats_per_row, half_row.begin(),
+                     float_to_half);
+      if (stream.Write(half_row.data(), header.row_bytes) !=
+          header.row_bytes) {
+        return false;
+      }
+    } else if (stream.Write(row, header.row_bytes) != header.row_bytes) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,38 @@
+// Bakes built animations into per-frame skinning matrices, written as
+// .skinbake textures (see skinbake.hpp) for crowd playback.
+
+#pragma once
+
+#include <array>
+#include <ozz/animation/runtime/animation.h>
+#include <ozz/animation/runtime/skeleton.h>
+#include <ozz/base/containers/vector.h>
+#include <ozz/base/io/stream.h>
+#include <ozz/base/maths/simd_math.h>
+#include <vector>
+
+struct baked_skinning {
+  size_t joint_count = 0;
+  size_t frame_count = 0;
+  float frame_rate = 0.0f;
+  float duration = 0.0f;
+  // frame_count * joint_count matrices, each the 3 rows of a 3x4 matrix.
+  std::vector<float> matrices;
+};
+
+// Loads column-major matrices, ie loader::SerializedMesh's
+// inverse_bind_matrices, for bake_skinning.
+ozz::vector<ozz::math::Float4x4> load_inverse_bind_matrices(
+    const std::vector<std::array<float, 16>> &matrices);
+
+// Samples `animation` every 1 / frame_rate seconds with SamplingJob and
+// LocalToModelJob, and multiplies each joint by its inverse bind matrix.
+bool bake_skinning(
+    const ozz::animation::Animation &animation,
+    const ozz::animation::Skeleton &skeleton,
+    const ozz::vector<ozz::math::Float4x4> &inverse_bind_matrices,
+    float frame_rate, baked_skinning &baked);
+
+// Writes `baked` in the .skinbake format, as half floats if `half`.
+bool write_skinbake(const baked_skinning &baked, bool half,
+                    ozz::io::Stream &stream);
@@ -0,0 +1,103 @@
+// Wall-clock time, allocations and peak memory of each stage of a
+// conversion, read back through loader::get_stage_timings by --stats and the
+// benchmark (bench.cpp).
+
+#pragma once
+
+#include "memory_stats.hpp"
+
+#include <algorithm>
+#include <cereal/cereal.hpp>
+#include <chrono>
+#include <string>
+#include <vector>
+
+struct stage_timing {
+  std::string stage;
+  double seconds = 0.0;
+  // Through operator new, on the thread running the stage.
+  size_t allocations = 0;
+  size_t allocated_bytes = 0;
+  // Peak RSS of the process when the stage ended.
+  size_t peak_rss_bytes = 0;
+
+  template <class Archive> void serialize(Archive &archive) {
+    archive(CEREAL_NVP(stage), CEREAL_NVP(seconds), CEREAL_NVP(allocations),
+            CEREAL_NVP(allocated_bytes), CEREAL_NVP(peak_rss_bytes));
+  }
+};
+
+// Measures a stage on the calling thread from construction to finish(), for
+// stages timed outside of stage_timings, ie per mesh in a parallel_for.
+class stage_sample {
+public:
+  typedef std::chrono::steady_clock clock;
+
+  stage_sample()
+      : start(clock::now()), start_allocations(thread_allocations()) {}
+
+  void finish(stage_timing &t) const {
+    const allocation_counts now = thread_allocations();
+    t.seconds = std::chrono::duration<double>(clock::now() - start).count();
+    t.allocations = now.count - start_allocations.count;
+    t.allocated_bytes = now.bytes - start_allocations.bytes;
+    t.peak_rss_bytes = peak_rss_bytes();
+  }
+
+private:
+  clock::time_point start;
+  allocation_counts start_allocations;
+};
+
+// Stages are laps: begin() ends the running stage and starts the next, so a
+// sequence of stages needs no extra scopes. Repeated stages add up in a
+// single entry, kept in order of first use.
+class stage_timings {
+public:
+  typedef stage_sample::clock clock;
+
+  void begin(const std::string &stage) {
+    end();
+    current = stage;
+    sample = stage_sample();
+  }
+
+  void end() {
+    if (!current.empty()) {
+      stage_timing t;
+      t.stage = current;
+      sample.finish(t);
+      add(t);
+      current.clear();
+    }
+  }
+
+  void add(const stage_timing &timing) {
+    for (stage_timing &t : timings) {
+      if (t.stage == timing.stage) {
+        t.seconds += timing.seconds;
+        t.allocations += timing.allocations;
+        t.allocated_bytes += timing.allocated_bytes;
+        t.peak_rss_bytes = std::max(t.peak_rss_bytes, timing.peak_rss_bytes);
+        return;
+      }
+    }
+    timings.push_back(timing);
+  }
+
+  void clear() {
+    timings.clear();
+    current.clear();
+  }
+
+  const std::vector<stage_timing> &get() const { return timings; }
+
+  static double seconds_since(clock::time_point t) {
+    return std::chrono::duration<double>(clock::now() - t).count();
+  }
+
+private:
+  std::vector<stage_timing> timings;
+  std::string current;
+  stage_sample sample;
+};
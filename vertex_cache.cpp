@@ -0,0 +1,236 @@
+#include "vertex_cache.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+// Size of the LRU cache Forsyth's scores are tuned for.
+const size_t kCacheSize = 32;
+const float kCacheDecayPower = 1.5f;
+const float kLastTriScore = 0.75f;
+const float kValenceBoostScale = 2.0f;
+const float kValenceBoostPower = 0.5f;
+
+float vertex_score(int cache_position, uint32_t remaining) {
+  if (remaining == 0) {
+    // No triangle left to emit.
+    return -1.0f;
+  }
+  float score = 0.0f;
+  if (cache_position >= 0) {
+    if (cache_position < 3) {
+      // Used by the last triangle: fixed score, so that the next triangle is
+      // not biased towards a particular edge of it.
+      score = kLastTriScore;
+    } else {
+      const float scaler = 1.0f / (kCacheSize - 3);
+      score = std::pow(1.0f - (cache_position - 3) * scaler, kCacheDecayPower);
+    }
+  }
+  // Vertices with few triangles left are worth finishing.
+  score += kValenceBoostScale *
+           std::pow(static_cast<float>(remaining), -kValenceBoostPower);
+  return score;
+}
+
+template <typename T>
+void apply_remap(std::vector<T> &data, const std::vector<uint32_t> &remap) {
+  if (data.empty()) {
+    return;
+  }
+  std::vector<T> remapped(data.size());
+  for (size_t i = 0; i < data.size(); ++i) {
+    remapped[remap[i]] = std::move(data[i]);
+  }
+  data.swap(remapped);
+}
+
+} // namespace
+
+void analyze_vertex_cache(const std::vector<uint32_t> &indices,
+                          size_t num_verts, float &acmr, float &atvr) {
+  // Time stamps of when each vertex entered the FIFO: a vertex is cached
+  // while fewer than kVertexCacheMeasureSize others entered after it.
+  std::vector<size_t> entered(num_verts, 0);
+  size_t misses = 0;
+  for (uint32_t index : indices) {
+    if (entered[index] == 0 ||
+        misses - entered[index] >= kVertexCacheMeasureSize) {
+      entered[index] = ++misses;
+    }
+  }
+  const size_t num_tris = indices.size() / 3;
+  acmr = num_tris ? static_cast<float>(misses) / num_tris : 0.0f;
+  atvr = num_verts ? static_cast<float>(misses) / num_verts : 0.0f;
+}
+
+void optimize_vertex_cache(std::vector<uint32_t> &indices, size_t num_verts) {
+  const size_t num_tris = indices.size() / 3;
+  if (num_tris == 0) {
+    return;
+  }
+
+  // Triangles using each vertex. The first remaining[v] entries of a
+  // vertex's range are the triangles not emitted yet.
+  std::vector<uint32_t> remaining(num_verts, 0);
+  for (size_t i = 0; i < num_tris * 3; ++i) {
+    remaining[indices[i]]++;
+  }
+  std::vector<uint32_t> offsets(num_verts + 1, 0);
+  for (size_t v = 0; v < num_verts; ++v) {
+    offsets[v + 1] = offsets[v] + remaining[v];
+  }
+  std::vector<uint32_t> adjacency(offsets[num_verts]);
+  {
+    std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < num_tris * 3; ++i) {
+      adjacency[cursor[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+  }
+
+  std::vector<int> cache_position(num_verts, -1);
+  std::vector<float> scores(num_verts);
+  for (size_t v = 0; v < num_verts; ++v) {
+    scores[v] = vertex_score(-1, remaining[v]);
+  }
+  std::vector<float> tri_scores(num_tris);
+  std::vector<bool> emitted(num_tris, false);
+  size_t best = 0;
+  for (size_t t = 0; t < num_tris; ++t) {
+    tri_scores[t] = scores[indices[t * 3]] + scores[indices[t * 3 + 1]] +
+                    scores[indices[t * 3 + 2]];
+    if (tri_scores[t] > tri_scores[best]) {
+      best = t;
+    }
+  }
+
+  std::vector<uint32_t> output;
+  output.reserve(num_tris * 3);
+  std::vector<uint32_t> cache, next_cache;
+  cache.reserve(kCacheSize + 3);
+  next_cache.reserve(kCacheSize + 3);
+  size_t scan = 0;
+
+  const size_t none = std::numeric_limits<size_t>::max();
+  while (best != none) {
+    emitted[best] = true;
+    const uint32_t *tri = &indices[best * 3];
+    output.insert(output.end(), tri, tri + 3);
+
+    // The emitted triangle's vertices move to the front of the cache.
+    next_cache.clear();
+    for (size_t k = 0; k < 3; ++k) {
+      const uint32_t v = tri[k];
+      uint32_t *begin = &adjacency[offsets[v]];
+      uint32_t *end = begin + remaining[v];
+      uint32_t *found = std::find(begin, end, static_cast<uint32_t>(best));
+      if (found != end) {
+        std::swap(*found, *(end - 1));
+        remaining[v]--;
+      }
+      if (std::find(next_cache.begin(), next_cache.end(), v) ==
+          next_cache.end()) {
+        next_cache.push_back(v);
+      }
+    }
+    for (uint32_t v : cache) {
+      if (std::find(next_cache.begin(), next_cache.end(), v) ==
+          next_cache.end()) {
+        next_cache.push_back(v);
+      }
+    }
+
+    // Rescores every vertex whose position changed, including those pushed
+    // out, and carries the change over to their remaining triangles.
+    for (size_t i = 0; i < next_cache.size(); ++i) {
+      const uint32_t v = next_cache[i];
+      cache_position[v] = i < kCacheSize ? static_cast<int>(i) : -1;
+      const float score = vertex_score(cache_position[v], remaining[v]);
+      const float delta = score - scores[v];
+      scores[v] = score;
+      for (uint32_t a = offsets[v]; a < offsets[v] + remaining[v]; ++a) {
+        tri_scores[adjacency[a]] += delta;
+      }
+    }
+    if (next_cache.size() > kCacheSize) {
+      next_cache.resize(kCacheSize);
+    }
+    cache.swap(next_cache);
+
+    // Next triangle: the best one touching the cache, otherwise the first
+    // one not emitted yet.
+    best = none;
+    float best_score = -std::numeric_limits<float>::max();
+    for (uint32_t v : cache) {
+      for (uint32_t a = offsets[v]; a < offsets[v] + remaining[v]; ++a) {
+        const uint32_t t = adjacency[a];
+        if (tri_scores[t] > best_score) {
+          best_score = tri_scores[t];
+          best = t;
+        }
+      }
+    }
+    if (best == none) {
+      while (scan < num_tris && emitted[scan]) {
+        scan++;
+      }
+      if (scan < num_tris) {
+        best = scan;
+      }
+    }
+  }
+  indices.swap(output);
+}
+
+void optimize_vertex_fetch(loader::SerializedMesh &mesh) {
+  const size_t num_verts = mesh.positions.size();
+  const uint32_t unused = std::numeric_limits<uint32_t>::max();
+  std::vector<uint32_t> remap(num_verts, unused);
+  uint32_t next = 0;
+  for (uint32_t &index : mesh.indices) {
+    if (remap[index] == unused) {
+      remap[index] = next++;
+    }
+    index = remap[index];
+  }
+  for (size_t v = 0; v < num_verts; ++v) {
+    if (remap[v] == unused) {
+      remap[v] = next++;
+    }
+  }
+
+  apply_remap(mesh.positions, remap);
+  apply_remap(mesh.normals, remap);
+  apply_remap(mesh.uvs, remap);
+  apply_remap(mesh.bone_indices, remap);
+  apply_remap(mesh.bone_weights, remap);
+}
+
+void optimize_mesh_vertex_cache(loader::SerializedMesh &mesh,
+                                vertex_cache_report &report) {
+  report.name = mesh.name;
+  const size_t num_verts = mesh.positions.size();
+  analyze_vertex_cache(mesh.indices, num_verts, report.acmr_before,
+                       report.atvr_before);
+
+  std::vector<uint32_t> indices = mesh.indices;
+  optimize_vertex_cache(indices, num_verts);
+  float acmr, atvr;
+  analyze_vertex_cache(indices, num_verts, acmr, atvr);
+  if (acmr < report.acmr_before) {
+    mesh.indices.swap(indices);
+  }
+  // Vertex order does not change which vertices hit the cache.
+  optimize_vertex_fetch(mesh);
+  analyze_vertex_cache(mesh.indices, num_verts, report.acmr_after,
+                       report.atvr_after);
+}
+
+void print_vertex_cache_report(const vertex_cache_report &report) {
+  LOG(INFO) << "Vertex cache of " << report.name << ": ACMR "
+            << report.acmr_before << " -> " << report.acmr_after << ", ATVR "
+            << report.atvr_before << " -> " << report.atvr_after << ".";
+}
@@ -0,0 +1,38 @@
+// Reorders triangles for the post-transform vertex cache, then vertices for
+// fetch locality.
+
+#pragma once
+
+#include "loader.hpp"
+
+// Cache efficiency of an index buffer, measured on a FIFO cache of
+// kVertexCacheMeasureSize entries. ACMR is transformed vertices per triangle
+// (0.5 at best for regular meshes, 3 at worst), ATVR transformed vertices per
+// vertex (1 at best).
+struct vertex_cache_report {
+  std::string name;
+  float acmr_before = 0.0f;
+  float atvr_before = 0.0f;
+  float acmr_after = 0.0f;
+  float atvr_after = 0.0f;
+};
+
+static const size_t kVertexCacheMeasureSize = 16;
+
+void analyze_vertex_cache(const std::vector<uint32_t> &indices,
+                          size_t num_verts, float &acmr, float &atvr);
+
+// Forsyth's linear-speed vertex cache optimization: greedily emits the
+// triangle whose vertices score best, favouring vertices recently used and
+// vertices with few triangles left.
+void optimize_vertex_cache(std::vector<uint32_t> &indices, size_t num_verts);
+
+// Renumbers vertices in order of first use by the index buffer, remapping
+// every per-vertex array of the mesh. Unreferenced vertices move to the end.
+void optimize_vertex_fetch(loader::SerializedMesh &mesh);
+
+// Both of the above, keeping the original triangle order if it was better.
+void optimize_mesh_vertex_cache(loader::SerializedMesh &mesh,
+                                vertex_cache_report &report);
+
+void print_vertex_cache_report(const vertex_cache_report &report);